@@ -11,8 +11,13 @@ layout(scalar, binding = 0) uniform UniformBufferObject {
     mat2 view;
 } ubo;
 
+layout(scalar, binding = 1) uniform DrawConstants {
+    mat3x2 transform;
+} draw;
+
 void main() {
-    vec2 out_position = ubo.view * in_position;
+    vec2 out_position = draw.transform[2] +
+        ubo.view * (mat2(draw.transform) * in_position);
     // debugPrintfEXT(
     //     "view: { { %f, %f, }, { %f, %f, }, },",
     //     ubo.view[0][0],
@@ -1,8 +1,85 @@
+#ifndef _WIN32
+    #define _DEFAULT_SOURCE
+#endif
+
 #define AVEN_MAX_ALIGNMENT
 #define AVEN_NO_FUNCTIONS
 #include "aven.h"
 
-void *arena_alloc(Arena *arena, size_t size, size_t align) {
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+// Pages are committed in large steps so that growing the arena does not
+// need a system call per allocation, and so that committed ranges can be
+// backed by transparent huge pages
+#define ARENA_COMMIT_SIZE (2UL * 1024UL * 1024UL)
+
+static bool arena_commit(Arena *arena, unsigned char *top) {
+    uintptr_t commit = (uintptr_t)top & ~(uintptr_t)(ARENA_COMMIT_SIZE - 1);
+    unsigned char *new_commit = (unsigned char *)commit;
+    if (new_commit < arena->base) {
+        new_commit = arena->base;
+    }
+    size_t size = (size_t)(arena->commit - new_commit);
+
+#ifdef _WIN32
+    void *memory = VirtualAlloc(new_commit, size, MEM_COMMIT, PAGE_READWRITE);
+    if (memory == NULL) {
+        return false;
+    }
+#else
+    if (mprotect(new_commit, size, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+#endif
+
+    arena->commit = new_commit;
+    return true;
+}
+
+static void arena_stats_record(
+    ArenaStats *stats,
+    unsigned char *top,
+    size_t size,
+    const char *file,
+    int line
+) {
+    ArenaPhase *phase = &stats->phases[stats->phase];
+    if (top == NULL) {
+        if (stats->failures == 0) {
+            stats->failed_size = size;
+            stats->failed_file = file;
+            stats->failed_line = line;
+            stats->failed_phase = phase->name;
+        }
+        stats->failures += 1;
+        return;
+    }
+
+    size_t usage = (size_t)(stats->end - top);
+    stats->allocations += 1;
+    phase->allocations += 1;
+    if (usage > stats->peak) {
+        stats->peak = usage;
+    }
+    if (usage > phase->peak) {
+        phase->peak = usage;
+    }
+}
+
+void *arena_alloc_internal(
+    Arena *arena,
+    size_t size,
+    size_t align,
+    const char *file,
+    int line
+) {
     assert(
         align == 1 ||
         align == 2 ||
@@ -11,11 +88,350 @@ void *arena_alloc(Arena *arena, size_t size, size_t align) {
         align == 16 ||
         align == 32
     );
+    unsigned char *top = NULL;
     unsigned char *mem = arena->top - size;
     size_t padding = (size_t)((uintptr_t)mem & (align - 1));
-    if ((arena->top - arena->base) < (ptrdiff_t)(size + padding)) {
+    if ((arena->top - arena->base) >= (ptrdiff_t)(size + padding)) {
+        top = mem - padding;
+        if (arena->commit != NULL && top < arena->commit) {
+            if (!arena_commit(arena, top)) {
+                top = NULL;
+            }
+        }
+    }
+
+    if (arena->stats != NULL) {
+        arena_stats_record(arena->stats, top, size, file, line);
+    }
+    if (top == NULL) {
         return NULL;
     }
-    arena->top = mem - padding;
+
+    arena->top = top;
     return arena->top;
 }
+
+void arena_stats_init(Arena *arena, ArenaStats *stats, const char *name) {
+    *stats = (ArenaStats){
+        .end = arena->top,
+        .size = (size_t)(arena->top - arena->base),
+        .phases = { { .name = name } },
+        .phase_count = 1,
+    };
+    arena->stats = stats;
+}
+
+const char *arena_phase(Arena *arena, const char *name) {
+    ArenaStats *stats = arena->stats;
+    if (stats == NULL) {
+        return NULL;
+    }
+
+    const char *previous = stats->phases[stats->phase].name;
+    size_t i = 0;
+    while (
+        i < stats->phase_count &&
+        strcmp(stats->phases[i].name, name) != 0
+    ) {
+        i += 1;
+    }
+    if (i == stats->phase_count) {
+        if (stats->phase_count == ARENA_MAX_PHASES) {
+            return previous;
+        }
+        stats->phases[i] = (ArenaPhase){ .name = name };
+        stats->phase_count += 1;
+    }
+    stats->phase = i;
+
+    return previous;
+}
+
+void arena_stats_report(ArenaStats *stats, const char *name) {
+    double kib = 1024.0;
+    printf(
+        "arena %s: %.1f KiB peak of %.1f KiB, %llu allocations\n",
+        name,
+        (double)stats->peak / kib,
+        (double)stats->size / kib,
+        (unsigned long long)stats->allocations
+    );
+    for (size_t i = 0; i < stats->phase_count; ++i) {
+        ArenaPhase *phase = &stats->phases[i];
+        printf(
+            "  %-10s %10.1f KiB peak, %llu allocations\n",
+            phase->name,
+            (double)phase->peak / kib,
+            (unsigned long long)phase->allocations
+        );
+    }
+    if (stats->failures > 0) {
+        printf(
+            "  %llu failed allocations, the first of %llu bytes at %s:%d"
+                " (%s)\n",
+            (unsigned long long)stats->failures,
+            (unsigned long long)stats->failed_size,
+            stats->failed_file,
+            stats->failed_line,
+            stats->failed_phase
+        );
+    }
+}
+
+Arena arena_reserve(size_t size, bool huge_pages) {
+#ifdef _WIN32
+    (void)huge_pages;
+    void *memory = VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+    if (memory == NULL) {
+        return (Arena){ 0 };
+    }
+#else
+    void *memory = mmap(
+        NULL,
+        size,
+        PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1,
+        0
+    );
+    if (memory == MAP_FAILED) {
+        return (Arena){ 0 };
+    }
+    #ifdef MADV_HUGEPAGE
+        if (huge_pages) {
+            madvise(memory, size, MADV_HUGEPAGE);
+        }
+    #else
+        (void)huge_pages;
+    #endif
+#endif
+
+    unsigned char *end = (unsigned char *)memory + size;
+    return (Arena){ .base = memory, .top = end, .commit = end };
+}
+
+void arena_release(Arena arena) {
+#ifdef _WIN32
+    VirtualFree(arena.base, 0, MEM_RELEASE);
+#else
+    munmap(arena.base, (size_t)(arena.top - arena.base));
+#endif
+}
+
+static AVEN_THREAD_LOCAL Arena scratch_arenas[SCRATCH_ARENA_COUNT];
+static AVEN_THREAD_LOCAL Arena scratch_reserved[SCRATCH_ARENA_COUNT];
+
+void scratch_release(void) {
+    for (size_t i = 0; i < SCRATCH_ARENA_COUNT; ++i) {
+        if (scratch_reserved[i].base != NULL) {
+            arena_release(scratch_reserved[i]);
+        }
+        scratch_reserved[i] = (Arena){ 0 };
+        scratch_arenas[i] = (Arena){ 0 };
+    }
+}
+
+bool scratch_init(size_t size) {
+    for (size_t i = 0; i < SCRATCH_ARENA_COUNT; ++i) {
+        scratch_reserved[i] = arena_reserve(size, false);
+        if (scratch_reserved[i].base == NULL) {
+            scratch_release();
+            return false;
+        }
+        scratch_arenas[i] = scratch_reserved[i];
+    }
+    return true;
+}
+
+ArenaMark scratch_begin(Arena *conflict) {
+    Arena *arena = &scratch_arenas[0];
+    if (arena == conflict) {
+        arena = &scratch_arenas[1];
+    }
+    assert(arena->base != NULL);
+    return (ArenaMark){ .arena = arena, .top = arena->top };
+}
+
+Pool pool_init_internal(size_t size, size_t align) {
+    // freed objects hold the next pointer of the free list
+    return (Pool){
+        .size = size < sizeof(void *) ? sizeof(void *) : size,
+        .align = align < sizeof(void *) ? sizeof(void *) : align,
+    };
+}
+
+void *pool_alloc_internal(
+    Pool *pool,
+    Arena *arena,
+    const char *file,
+    int line
+) {
+    void *object = pool->free_list;
+    if (object == NULL) {
+        return arena_alloc_internal(
+            arena,
+            pool->size,
+            pool->align,
+            file,
+            line
+        );
+    }
+
+    memcpy(&pool->free_list, object, sizeof(pool->free_list));
+    return object;
+}
+
+void pool_free(Pool *pool, void *object) {
+    memcpy(object, &pool->free_list, sizeof(pool->free_list));
+    pool->free_list = object;
+}
+
+void *vec_grow_internal(
+    void *ptr,
+    size_t len,
+    size_t *cap,
+    size_t min_cap,
+    size_t size,
+    Arena *arena,
+    const char *file,
+    int line
+) {
+    // the alignment of a type divides its size
+    size_t align = size & (~size + 1);
+    if (align > 32) {
+        align = 32;
+    }
+
+    size_t new_cap = *cap == 0 ? 8 : 2 * *cap;
+    while (new_cap < min_cap) {
+        new_cap *= 2;
+    }
+    void *new_ptr = arena_alloc_internal(
+        arena,
+        new_cap * size,
+        align,
+        file,
+        line
+    );
+    if (new_ptr == NULL) {
+        return ptr;
+    }
+    if (len > 0) {
+        memcpy(new_ptr, ptr, len * size);
+    }
+
+    *cap = new_cap;
+    return new_ptr;
+}
+
+static size_t hash_map_index(HashMap *map, uint64_t key) {
+    // splitmix64 finalizer
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (size_t)key & (map->cap - 1);
+}
+
+bool hash_map_init(HashMap *map, Arena *arena, size_t cap) {
+    // keep the load factor at or below 3/4
+    size_t slots = 8;
+    while (slots / 4 * 3 < cap) {
+        slots *= 2;
+    }
+
+    HashMap new_map = { .cap = slots };
+    new_map.keys = arena_alloc(arena, slots * sizeof(uint64_t), 8);
+    new_map.values = arena_alloc(arena, slots * sizeof(uint64_t), 8);
+    new_map.used = arena_alloc(arena, slots * sizeof(bool), 1);
+    if (
+        new_map.keys == NULL ||
+        new_map.values == NULL ||
+        new_map.used == NULL
+    ) {
+        return false;
+    }
+    memset(new_map.used, 0, slots * sizeof(bool));
+
+    *map = new_map;
+    return true;
+}
+
+uint64_t *hash_map_get(HashMap *map, uint64_t key) {
+    if (map->cap == 0) {
+        return NULL;
+    }
+
+    size_t i = hash_map_index(map, key);
+    while (map->used[i]) {
+        if (map->keys[i] == key) {
+            return &map->values[i];
+        }
+        i = (i + 1) & (map->cap - 1);
+    }
+
+    return NULL;
+}
+
+uint64_t *hash_map_put(HashMap *map, Arena *arena, uint64_t key) {
+    uint64_t *value = hash_map_get(map, key);
+    if (value != NULL) {
+        return value;
+    }
+
+    if ((map->len + 1) > map->cap / 4 * 3) {
+        HashMap new_map;
+        if (!hash_map_init(&new_map, arena, map->len + 1)) {
+            return NULL;
+        }
+        for (size_t i = 0; i < map->cap; ++i) {
+            if (map->used[i]) {
+                *hash_map_put(&new_map, arena, map->keys[i]) =
+                    map->values[i];
+            }
+        }
+        *map = new_map;
+    }
+
+    size_t i = hash_map_index(map, key);
+    while (map->used[i]) {
+        i = (i + 1) & (map->cap - 1);
+    }
+    map->used[i] = true;
+    map->keys[i] = key;
+    map->values[i] = 0;
+    map->len += 1;
+
+    return &map->values[i];
+}
+
+bool hash_map_remove(HashMap *map, uint64_t key) {
+    uint64_t *value = hash_map_get(map, key);
+    if (value == NULL) {
+        return false;
+    }
+
+    // shift later entries of the probe sequence back into the hole so that
+    // lookups never stop early
+    size_t hole = (size_t)(value - map->values);
+    size_t i = hole;
+    for (;;) {
+        i = (i + 1) & (map->cap - 1);
+        if (!map->used[i]) {
+            break;
+        }
+        size_t home = hash_map_index(map, map->keys[i]);
+        bool movable = ((i - home) & (map->cap - 1)) >=
+            ((i - hole) & (map->cap - 1));
+        if (movable) {
+            map->keys[hole] = map->keys[i];
+            map->values[hole] = map->values[i];
+            hole = i;
+        }
+    }
+    map->used[hole] = false;
+    map->len -= 1;
+
+    return true;
+}
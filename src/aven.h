@@ -35,17 +35,101 @@
     #error "C99 or later is required"
 #endif
 
+#if __STDC_VERSION__ >= 201112L
+    #define AVEN_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+    #define AVEN_THREAD_LOCAL __thread
+#else
+    #error "thread local storage is required"
+#endif
+
 #define Optional(t) struct { t value; bool valid; }
 #define Result(t) struct { t payload; int error; }
 #define Slice(t) struct { t *ptr; size_t len; }
 
 typedef Slice(unsigned char) ByteSlice;
 
+#define ARENA_MAX_PHASES 8
+
+typedef struct {
+    const char *name;
+    // highest number of bytes in use while the phase was active
+    size_t peak;
+    size_t allocations;
+} ArenaPhase;
+
+// Optional instrumentation shared by an arena and every copy made of it.
+// Usage is measured from the top of the arena as it was when the stats were
+// attached
+typedef struct {
+    unsigned char *end;
+    size_t size;
+    size_t peak;
+    size_t allocations;
+    ArenaPhase phases[ARENA_MAX_PHASES];
+    size_t phase_count;
+    size_t phase;
+    // the first allocation that did not fit
+    size_t failures;
+    size_t failed_size;
+    const char *failed_file;
+    int failed_line;
+    const char *failed_phase;
+} ArenaStats;
+
+// Allocations are taken from the top down. Reserved arenas only have the
+// pages from `commit` up accessible and commit more as they grow, `commit`
+// is NULL for arenas over ordinary memory
 typedef struct {
     unsigned char *base;
     unsigned char *top;
+    unsigned char *commit;
+    ArenaStats *stats;
 } Arena;
 
+#define arena_alloc(a, size, align) arena_alloc_internal( \
+        a, \
+        size, \
+        align, \
+        __FILE__, \
+        __LINE__ \
+    )
+
+// Everything allocated from `arena` after the mark was taken is freed when
+// rewinding to it
+typedef struct {
+    Arena *arena;
+    unsigned char *top;
+} ArenaMark;
+
+// Fixed size objects are recycled through an intrusive free list, new ones
+// are taken from an arena
+typedef struct {
+    size_t size;
+    size_t align;
+    void *free_list;
+} Pool;
+
+// Growable array in an arena. Growing copies the elements to a buffer of
+// twice the capacity, so at most as much arena space as the final buffer is
+// left behind. A zero initialized vector is empty
+#define Vec(t) struct { t *ptr; size_t len; size_t cap; }
+
+// Open addressing map from 64-bit keys to 64-bit values with linear probing
+// and backward shift deletion. The capacity is a power of two
+typedef struct {
+    uint64_t *keys;
+    uint64_t *values;
+    bool *used;
+    size_t cap;
+    size_t len;
+} HashMap;
+
+// Each thread has two scratch arenas. A function that allocates its result
+// in one arena gets the other one as scratch, so nested scratch scopes
+// never free memory that a caller still uses
+#define SCRATCH_ARENA_COUNT 2
+
 #ifndef AVEN_NO_FUNCTIONS
     #ifdef __GNUC__
         static size_t aven_assert_smaller_internal(size_t a, size_t b) {
@@ -83,7 +167,38 @@ typedef struct {
     #ifdef __GNUC__
         __attribute__((malloc, alloc_size(2), alloc_align(3)))
     #endif
-    void *arena_alloc(Arena *arena, size_t size, size_t align);
+    void *arena_alloc_internal(
+        Arena *arena,
+        size_t size,
+        size_t align,
+        const char *file,
+        int line
+    );
+
+    // Record the usage of `arena` and of all arenas copied from it, with
+    // allocations attributed to the phase named `name`
+    void arena_stats_init(Arena *arena, ArenaStats *stats, const char *name);
+    // Start attributing allocations to the phase `name` and return the name
+    // of the previous phase. Without stats it does nothing and returns NULL
+    const char *arena_phase(Arena *arena, const char *name);
+    void arena_stats_report(ArenaStats *stats, const char *name);
+
+    // Reserve `size` bytes of address space without backing them, returns
+    // an arena with a NULL base on failure
+    Arena arena_reserve(size_t size, bool huge_pages);
+    // Release a reserved arena, must be passed the arena as reserved
+    void arena_release(Arena arena);
+
+    #define arena_mark(a) ((ArenaMark){ .arena = (a), .top = (a)->top })
+    #define arena_rewind(m) ((m).arena->top = (m).top)
+
+    // Reserve the scratch arenas of the calling thread, each `size` bytes
+    // of address space that is only committed as it is used
+    bool scratch_init(size_t size);
+    void scratch_release(void);
+    // Begin a scratch scope in a scratch arena other than `conflict`, which
+    // may be NULL. The scope ends with `arena_rewind`
+    ArenaMark scratch_begin(Arena *conflict);
 
     #define arena_create(t, a) (t *)arena_alloc(a, sizeof(t), alignof(t))
     #define arena_create_array(t, a, n) (t *)arena_alloc( \
@@ -91,6 +206,77 @@ typedef struct {
             n * sizeof(t), \
             alignof(t) \
         )
+
+    Pool pool_init_internal(size_t size, size_t align);
+    void *pool_alloc_internal(
+        Pool *pool,
+        Arena *arena,
+        const char *file,
+        int line
+    );
+    void pool_free(Pool *pool, void *object);
+
+    #define pool_init(t) pool_init_internal(sizeof(t), alignof(t))
+    // Returns NULL if the free list is empty and the arena is full
+    #define pool_alloc(p, a) pool_alloc_internal(p, a, __FILE__, __LINE__)
+    #define pool_create(t, p, a) (t *)pool_alloc(p, a)
+
+    void *vec_grow_internal(
+        void *ptr,
+        size_t len,
+        size_t *cap,
+        size_t min_cap,
+        size_t size,
+        Arena *arena,
+        const char *file,
+        int line
+    );
+
+    // Pointer to the new last element, or NULL if the arena is full
+    #define vec_push(v, a) ( \
+            ( \
+                (v).len < (v).cap or ( \
+                    (v).ptr = vec_grow_internal( \
+                        (v).ptr, \
+                        (v).len, \
+                        &(v).cap, \
+                        (v).len + 1, \
+                        sizeof(*(v).ptr), \
+                        a, \
+                        __FILE__, \
+                        __LINE__ \
+                    ), \
+                    (v).len < (v).cap \
+                ) \
+            ) ? &(v).ptr[(v).len++] : NULL \
+        )
+    // Make room for at least `n` elements, false if the arena is full
+    #define vec_reserve(v, n, a) ( \
+            (n) <= (v).cap or ( \
+                (v).ptr = vec_grow_internal( \
+                    (v).ptr, \
+                    (v).len, \
+                    &(v).cap, \
+                    n, \
+                    sizeof(*(v).ptr), \
+                    a, \
+                    __FILE__, \
+                    __LINE__ \
+                ), \
+                (n) <= (v).cap \
+            ) \
+        )
+    #define vec_pop(v) ((v).ptr[--(v).len])
+    #define vec_clear(v) ((v).len = 0)
+
+    // Room for `cap` entries before the map has to grow
+    bool hash_map_init(HashMap *map, Arena *arena, size_t cap);
+    // Pointer to the value stored for `key`, or NULL if there is none
+    uint64_t *hash_map_get(HashMap *map, uint64_t key);
+    // Pointer to the value for `key`, which is zero if it was just inserted.
+    // Returns NULL if the map had to grow and the arena is full
+    uint64_t *hash_map_put(HashMap *map, Arena *arena, uint64_t key);
+    bool hash_map_remove(HashMap *map, uint64_t key);
 #endif
 
 #endif // AVEN_H
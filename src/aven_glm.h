@@ -3,6 +3,9 @@
 
 #include "aven.h"
 
+#include <math.h>
+#include <string.h>
+
 #define AVEN_GLM_PI_D 3.14159265358979323846264338327950288
 #define AVEN_GLM_PI_F 3.14159265358979323846264338327950288f
 
@@ -10,6 +13,7 @@ typedef struct { float data[2]; } Vec2;
 typedef struct { float data[3]; } Vec3;
 typedef struct { float data[4]; } Vec4;
 
+// Matrices are column major, `data[i]` is column `i`
 typedef struct { Vec2 data[2]; } Mat2;
 typedef struct { Vec3 data[3]; } Mat3;
 typedef struct { Vec4 data[4]; } Mat4;
@@ -26,17 +30,868 @@ typedef struct { Vec4 data[3]; } Mat4x3;
 #define vec_get(v, i) v.data[i]
 #define mat_get(m, i, j) vec_get(m.data[i], j)
 
-static Mat2 mat2_mul_mat2(Mat2 a, Mat2 b) {
-    Mat2 dest;
-    mat_get(dest, 0, 0) = mat_get(a, 0, 0) * mat_get(b, 0, 0) +
-        mat_get(a, 1, 0) * mat_get(b, 0, 1);
-    mat_get(dest, 0, 1) = mat_get(a, 0, 1) * mat_get(b, 0, 0) +
-        mat_get(a, 1, 1) * mat_get(b, 0, 1);
-    mat_get(dest, 1, 0) = mat_get(a, 0, 0) * mat_get(b, 1, 0) +
-        mat_get(a, 0, 1) * mat_get(b, 1, 1);
-    mat_get(dest, 1, 1) = mat_get(a, 0, 1) * mat_get(b, 1, 0) +
-        mat_get(a, 1 , 1) * mat_get(b, 1, 1);
+// Four float lanes in a SIMD register. The backend is picked at compile
+// time from the target, define AVEN_GLM_SCALAR to force the portable one
+#if defined(AVEN_GLM_SCALAR)
+#elif defined(__AVX__)
+    #define AVEN_GLM_SSE
+    #define AVEN_GLM_AVX
+    #include <immintrin.h>
+#elif defined(__SSE2__) or defined(_M_X64)
+    #define AVEN_GLM_SSE
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) or defined(__ARM_NEON__)
+    #define AVEN_GLM_NEON
+    #include <arm_neon.h>
+#else
+    #define AVEN_GLM_SCALAR
+#endif
+
+#if defined(AVEN_GLM_SSE)
+    typedef __m128 AvenGlmF4;
+
+    #define aven_glm_f4_load(p) _mm_loadu_ps(p)
+    #define aven_glm_f4_store(p, v) _mm_storeu_ps(p, v)
+    #define aven_glm_f4_set1(f) _mm_set1_ps(f)
+    #define aven_glm_f4_add(a, b) _mm_add_ps(a, b)
+    #define aven_glm_f4_sub(a, b) _mm_sub_ps(a, b)
+    #define aven_glm_f4_mul(a, b) _mm_mul_ps(a, b)
+    #define aven_glm_f4_shuffle(v, x, y, z, w) _mm_shuffle_ps( \
+            v, \
+            v, \
+            _MM_SHUFFLE(w, z, y, x) \
+        )
+    #ifdef __FMA__
+        #define aven_glm_f4_madd(a, b, c) _mm_fmadd_ps(a, b, c)
+    #else
+        #define aven_glm_f4_madd(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+    #endif
+#elif defined(AVEN_GLM_NEON)
+    typedef float32x4_t AvenGlmF4;
+
+    #define aven_glm_f4_load(p) vld1q_f32(p)
+    #define aven_glm_f4_store(p, v) vst1q_f32(p, v)
+    #define aven_glm_f4_set1(f) vdupq_n_f32(f)
+    #define aven_glm_f4_add(a, b) vaddq_f32(a, b)
+    #define aven_glm_f4_sub(a, b) vsubq_f32(a, b)
+    #define aven_glm_f4_mul(a, b) vmulq_f32(a, b)
+    #define aven_glm_f4_shuffle(v, x, y, z, w) aven_glm_neon_shuffle( \
+            v, \
+            x, \
+            y, \
+            z, \
+            w \
+        )
+    #ifdef __aarch64__
+        #define aven_glm_f4_madd(a, b, c) vfmaq_f32(c, a, b)
+    #else
+        #define aven_glm_f4_madd(a, b, c) vmlaq_f32(c, a, b)
+    #endif
+
+    // NEON has no general permute, the compiler turns this into lane moves
+    static inline float32x4_t aven_glm_neon_shuffle(
+        float32x4_t v,
+        int x,
+        int y,
+        int z,
+        int w
+    ) {
+        float lanes[4];
+        vst1q_f32(lanes, v);
+        float shuffled[4] = { lanes[x], lanes[y], lanes[z], lanes[w] };
+        return vld1q_f32(shuffled);
+    }
+#else
+    typedef struct { float lane[4]; } AvenGlmF4;
+
+    static inline AvenGlmF4 aven_glm_f4_load(const float *p) {
+        AvenGlmF4 v;
+        memcpy(v.lane, p, sizeof(v.lane));
+        return v;
+    }
+
+    static inline void aven_glm_f4_store(float *p, AvenGlmF4 v) {
+        memcpy(p, v.lane, sizeof(v.lane));
+    }
+
+    static inline AvenGlmF4 aven_glm_f4_set1(float f) {
+        return (AvenGlmF4){ { f, f, f, f } };
+    }
+
+    static inline AvenGlmF4 aven_glm_f4_add(AvenGlmF4 a, AvenGlmF4 b) {
+        for (int i = 0; i < 4; ++i) {
+            a.lane[i] += b.lane[i];
+        }
+        return a;
+    }
+
+    static inline AvenGlmF4 aven_glm_f4_sub(AvenGlmF4 a, AvenGlmF4 b) {
+        for (int i = 0; i < 4; ++i) {
+            a.lane[i] -= b.lane[i];
+        }
+        return a;
+    }
+
+    static inline AvenGlmF4 aven_glm_f4_mul(AvenGlmF4 a, AvenGlmF4 b) {
+        for (int i = 0; i < 4; ++i) {
+            a.lane[i] *= b.lane[i];
+        }
+        return a;
+    }
+
+    static inline AvenGlmF4 aven_glm_f4_shuffle(
+        AvenGlmF4 v,
+        int x,
+        int y,
+        int z,
+        int w
+    ) {
+        return (AvenGlmF4){
+            { v.lane[x], v.lane[y], v.lane[z], v.lane[w] }
+        };
+    }
+
+    #define aven_glm_f4_madd(a, b, c) aven_glm_f4_add( \
+            aven_glm_f4_mul(a, b), \
+            c \
+        )
+#endif
+
+#define aven_glm_f4_splat(v, i) aven_glm_f4_shuffle(v, i, i, i, i)
+
+// Narrower vectors and matrices are moved through registers with unused
+// lanes set to zero
+static inline AvenGlmF4 aven_glm_f4_load_n(const float *p, size_t n) {
+    float lanes[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    memcpy(lanes, p, n * sizeof(float));
+    return aven_glm_f4_load(lanes);
+}
+
+static inline void aven_glm_f4_store_n(float *p, size_t n, AvenGlmF4 v) {
+    float lanes[4];
+    aven_glm_f4_store(lanes, v);
+    memcpy(p, lanes, n * sizeof(float));
+}
+
+// Round to nearest by pushing the fraction out of the mantissa, valid for
+// magnitudes below 2^22 and free of any float to integer conversion
+static inline AvenGlmF4 aven_glm_f4_round(AvenGlmF4 v) {
+    AvenGlmF4 magic = aven_glm_f4_set1(12582912.0f);
+    return aven_glm_f4_sub(aven_glm_f4_add(v, magic), magic);
+}
+
+// 1 for odd and 0 for even lanes of a vector of whole numbers
+static inline AvenGlmF4 aven_glm_f4_parity(AvenGlmF4 n) {
+    AvenGlmF4 half = aven_glm_f4_set1(0.5f);
+    AvenGlmF4 floor_half = aven_glm_f4_round(
+        aven_glm_f4_sub(aven_glm_f4_mul(n, half), aven_glm_f4_set1(0.25f))
+    );
+    return aven_glm_f4_sub(
+        n,
+        aven_glm_f4_add(floor_half, floor_half)
+    );
+}
+
+// Sine and cosine of four angles at once, accurate to a few ulp for
+// |x| < 8192. The angle is reduced to [-pi/4, pi/4] around the nearest
+// multiple of pi/2 and the quadrant picks and signs the two polynomials,
+// all with plain float arithmetic so every backend runs the same code
+static inline void aven_glm_f4_sincos(
+    AvenGlmF4 x,
+    AvenGlmF4 *sin_dest,
+    AvenGlmF4 *cos_dest
+) {
+    AvenGlmF4 one = aven_glm_f4_set1(1.0f);
+    AvenGlmF4 two = aven_glm_f4_set1(2.0f);
+
+    AvenGlmF4 q = aven_glm_f4_round(
+        aven_glm_f4_mul(x, aven_glm_f4_set1(0.636619772367581343f))
+    );
+
+    // pi/2 split in three so each product with q is exact
+    AvenGlmF4 r = aven_glm_f4_madd(q, aven_glm_f4_set1(-1.5703125f), x);
+    r = aven_glm_f4_madd(q, aven_glm_f4_set1(-4.837512969970703125e-4f), r);
+    r = aven_glm_f4_madd(q, aven_glm_f4_set1(-7.54978995489e-8f), r);
+    AvenGlmF4 r2 = aven_glm_f4_mul(r, r);
+
+    AvenGlmF4 s = aven_glm_f4_madd(
+        r2,
+        aven_glm_f4_set1(-1.9515295891e-4f),
+        aven_glm_f4_set1(8.3321608736e-3f)
+    );
+    s = aven_glm_f4_madd(s, r2, aven_glm_f4_set1(-1.6666654611e-1f));
+    s = aven_glm_f4_madd(aven_glm_f4_mul(s, r2), r, r);
+
+    AvenGlmF4 c = aven_glm_f4_madd(
+        r2,
+        aven_glm_f4_set1(2.443315711809948e-5f),
+        aven_glm_f4_set1(-1.388731625493765e-3f)
+    );
+    c = aven_glm_f4_madd(c, r2, aven_glm_f4_set1(4.166664568298827e-2f));
+    c = aven_glm_f4_mul(aven_glm_f4_mul(c, r2), r2);
+    c = aven_glm_f4_add(
+        aven_glm_f4_madd(r2, aven_glm_f4_set1(-0.5f), one),
+        c
+    );
+
+    // odd quadrants swap sine and cosine, quadrants 2 and 3 negate the
+    // sine and quadrants 1 and 2 negate the cosine
+    AvenGlmF4 odd = aven_glm_f4_parity(q);
+    AvenGlmF4 half_q = aven_glm_f4_round(
+        aven_glm_f4_mul(aven_glm_f4_sub(q, odd), aven_glm_f4_set1(0.5f))
+    );
+    AvenGlmF4 sin_sign = aven_glm_f4_sub(
+        one,
+        aven_glm_f4_mul(two, aven_glm_f4_parity(half_q))
+    );
+    AvenGlmF4 cos_sign = aven_glm_f4_sub(
+        one,
+        aven_glm_f4_mul(two, aven_glm_f4_parity(aven_glm_f4_add(half_q, odd)))
+    );
+
+    AvenGlmF4 diff = aven_glm_f4_sub(c, s);
+    *sin_dest = aven_glm_f4_mul(sin_sign, aven_glm_f4_madd(odd, diff, s));
+    *cos_dest = aven_glm_f4_mul(
+        cos_sign,
+        aven_glm_f4_sub(c, aven_glm_f4_mul(odd, diff))
+    );
+}
+
+static inline Vec2 vec2_add(Vec2 a, Vec2 b) {
+    return (Vec2){ { a.data[0] + b.data[0], a.data[1] + b.data[1] } };
+}
+
+static inline Vec2 vec2_sub(Vec2 a, Vec2 b) {
+    return (Vec2){ { a.data[0] - b.data[0], a.data[1] - b.data[1] } };
+}
+
+static inline Vec2 vec2_scale(Vec2 v, float s) {
+    return (Vec2){ { v.data[0] * s, v.data[1] * s } };
+}
+
+static inline float vec2_dot(Vec2 a, Vec2 b) {
+    return a.data[0] * b.data[0] + a.data[1] * b.data[1];
+}
+
+static inline Vec3 vec3_add(Vec3 a, Vec3 b) {
+    Vec3 dest;
+    aven_glm_f4_store_n(
+        dest.data,
+        3,
+        aven_glm_f4_add(
+            aven_glm_f4_load_n(a.data, 3),
+            aven_glm_f4_load_n(b.data, 3)
+        )
+    );
+    return dest;
+}
+
+static inline Vec3 vec3_sub(Vec3 a, Vec3 b) {
+    Vec3 dest;
+    aven_glm_f4_store_n(
+        dest.data,
+        3,
+        aven_glm_f4_sub(
+            aven_glm_f4_load_n(a.data, 3),
+            aven_glm_f4_load_n(b.data, 3)
+        )
+    );
+    return dest;
+}
+
+static inline Vec3 vec3_scale(Vec3 v, float s) {
+    Vec3 dest;
+    aven_glm_f4_store_n(
+        dest.data,
+        3,
+        aven_glm_f4_mul(aven_glm_f4_load_n(v.data, 3), aven_glm_f4_set1(s))
+    );
     return dest;
 }
 
+static inline float vec3_dot(Vec3 a, Vec3 b) {
+    return a.data[0] * b.data[0] + a.data[1] * b.data[1] +
+        a.data[2] * b.data[2];
+}
+
+static inline Vec3 vec3_cross(Vec3 a, Vec3 b) {
+    return (Vec3){ {
+        a.data[1] * b.data[2] - a.data[2] * b.data[1],
+        a.data[2] * b.data[0] - a.data[0] * b.data[2],
+        a.data[0] * b.data[1] - a.data[1] * b.data[0],
+    } };
+}
+
+static inline Vec3 vec3_normalize(Vec3 v) {
+    return vec3_scale(v, 1.0f / sqrtf(vec3_dot(v, v)));
+}
+
+static inline Vec4 vec4_add(Vec4 a, Vec4 b) {
+    Vec4 dest;
+    aven_glm_f4_store(
+        dest.data,
+        aven_glm_f4_add(aven_glm_f4_load(a.data), aven_glm_f4_load(b.data))
+    );
+    return dest;
+}
+
+static inline Vec4 vec4_sub(Vec4 a, Vec4 b) {
+    Vec4 dest;
+    aven_glm_f4_store(
+        dest.data,
+        aven_glm_f4_sub(aven_glm_f4_load(a.data), aven_glm_f4_load(b.data))
+    );
+    return dest;
+}
+
+static inline Vec4 vec4_mul(Vec4 a, Vec4 b) {
+    Vec4 dest;
+    aven_glm_f4_store(
+        dest.data,
+        aven_glm_f4_mul(aven_glm_f4_load(a.data), aven_glm_f4_load(b.data))
+    );
+    return dest;
+}
+
+static inline Vec4 vec4_scale(Vec4 v, float s) {
+    Vec4 dest;
+    aven_glm_f4_store(
+        dest.data,
+        aven_glm_f4_mul(aven_glm_f4_load(v.data), aven_glm_f4_set1(s))
+    );
+    return dest;
+}
+
+static inline float vec4_dot(Vec4 a, Vec4 b) {
+    float lanes[4];
+    aven_glm_f4_store(
+        lanes,
+        aven_glm_f4_mul(aven_glm_f4_load(a.data), aven_glm_f4_load(b.data))
+    );
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// A Mat2 fits a single register as [m00 m01 m10 m11]
+static inline AvenGlmF4 aven_glm_mat2_load(Mat2 m) {
+    float lanes[4];
+    memcpy(lanes, &m, sizeof(lanes));
+    return aven_glm_f4_load(lanes);
+}
+
+static inline Mat2 aven_glm_mat2_store(AvenGlmF4 v) {
+    float lanes[4];
+    aven_glm_f4_store(lanes, v);
+    Mat2 m;
+    memcpy(&m, lanes, sizeof(m));
+    return m;
+}
+
+static inline Mat2 mat2_identity(void) {
+    return (Mat2){ { { { 1.0f, 0.0f } }, { { 0.0f, 1.0f } } } };
+}
+
+static inline Mat2 mat2_mul_mat2(Mat2 a, Mat2 b) {
+    AvenGlmF4 va = aven_glm_mat2_load(a);
+    AvenGlmF4 vb = aven_glm_mat2_load(b);
+    AvenGlmF4 a_col0 = aven_glm_f4_shuffle(va, 0, 1, 0, 1);
+    AvenGlmF4 a_col1 = aven_glm_f4_shuffle(va, 2, 3, 2, 3);
+    AvenGlmF4 b_x = aven_glm_f4_shuffle(vb, 0, 0, 2, 2);
+    AvenGlmF4 b_y = aven_glm_f4_shuffle(vb, 1, 1, 3, 3);
+    return aven_glm_mat2_store(
+        aven_glm_f4_madd(a_col0, b_x, aven_glm_f4_mul(a_col1, b_y))
+    );
+}
+
+static inline Vec2 mat2_mul_vec2(Mat2 m, Vec2 v) {
+    return (Vec2){ {
+        mat_get(m, 0, 0) * v.data[0] + mat_get(m, 1, 0) * v.data[1],
+        mat_get(m, 0, 1) * v.data[0] + mat_get(m, 1, 1) * v.data[1],
+    } };
+}
+
+static inline Mat2 mat2_transpose(Mat2 m) {
+    return aven_glm_mat2_store(
+        aven_glm_f4_shuffle(aven_glm_mat2_load(m), 0, 2, 1, 3)
+    );
+}
+
+// The matrix must be invertible
+static inline Mat2 mat2_inverse(Mat2 m) {
+    float det = mat_get(m, 0, 0) * mat_get(m, 1, 1) -
+        mat_get(m, 1, 0) * mat_get(m, 0, 1);
+    AvenGlmF4 adjugate = aven_glm_f4_mul(
+        aven_glm_f4_shuffle(aven_glm_mat2_load(m), 3, 1, 2, 0),
+        aven_glm_f4_load(((float[4]){ 1.0f, -1.0f, -1.0f, 1.0f }))
+    );
+    return aven_glm_mat2_store(
+        aven_glm_f4_mul(adjugate, aven_glm_f4_set1(1.0f / det))
+    );
+}
+
+// Counter-clockwise rotation by `angle` radians
+static inline Mat2 mat2_rotation(float angle) {
+    float s = sinf(angle);
+    float c = cosf(angle);
+    return (Mat2){ { { { c, s } }, { { -s, c } } } };
+}
+
+static inline Mat2 mat2_scaling(Vec2 s) {
+    return (Mat2){ { { { s.data[0], 0.0f } }, { { 0.0f, s.data[1] } } } };
+}
+
+static inline Mat3 mat3_identity(void) {
+    return (Mat3){ {
+        { { 1.0f, 0.0f, 0.0f } },
+        { { 0.0f, 1.0f, 0.0f } },
+        { { 0.0f, 0.0f, 1.0f } },
+    } };
+}
+
+static inline Mat3 mat3_mul_mat3(Mat3 a, Mat3 b) {
+    AvenGlmF4 a_cols[3];
+    for (size_t i = 0; i < 3; ++i) {
+        a_cols[i] = aven_glm_f4_load_n(a.data[i].data, 3);
+    }
+
+    Mat3 dest;
+    for (size_t j = 0; j < 3; ++j) {
+        AvenGlmF4 col = aven_glm_f4_mul(
+            a_cols[0],
+            aven_glm_f4_set1(mat_get(b, j, 0))
+        );
+        col = aven_glm_f4_madd(
+            a_cols[1],
+            aven_glm_f4_set1(mat_get(b, j, 1)),
+            col
+        );
+        col = aven_glm_f4_madd(
+            a_cols[2],
+            aven_glm_f4_set1(mat_get(b, j, 2)),
+            col
+        );
+        aven_glm_f4_store_n(dest.data[j].data, 3, col);
+    }
+    return dest;
+}
+
+static inline Vec3 mat3_mul_vec3(Mat3 m, Vec3 v) {
+    AvenGlmF4 col = aven_glm_f4_mul(
+        aven_glm_f4_load_n(m.data[0].data, 3),
+        aven_glm_f4_set1(v.data[0])
+    );
+    col = aven_glm_f4_madd(
+        aven_glm_f4_load_n(m.data[1].data, 3),
+        aven_glm_f4_set1(v.data[1]),
+        col
+    );
+    col = aven_glm_f4_madd(
+        aven_glm_f4_load_n(m.data[2].data, 3),
+        aven_glm_f4_set1(v.data[2]),
+        col
+    );
+    Vec3 dest;
+    aven_glm_f4_store_n(dest.data, 3, col);
+    return dest;
+}
+
+static inline Mat3 mat3_transpose(Mat3 m) {
+    Mat3 dest;
+    for (size_t i = 0; i < 3; ++i) {
+        for (size_t j = 0; j < 3; ++j) {
+            mat_get(dest, i, j) = mat_get(m, j, i);
+        }
+    }
+    return dest;
+}
+
+// The matrix must be invertible
+static inline Mat3 mat3_inverse(Mat3 m) {
+    // the rows of the inverse are the cross products of the columns
+    Vec3 r0 = vec3_cross(m.data[1], m.data[2]);
+    Vec3 r1 = vec3_cross(m.data[2], m.data[0]);
+    Vec3 r2 = vec3_cross(m.data[0], m.data[1]);
+    float inv_det = 1.0f / vec3_dot(m.data[0], r0);
+
+    Mat3 rows = { { r0, r1, r2 } };
+    Mat3 dest = mat3_transpose(rows);
+    for (size_t i = 0; i < 3; ++i) {
+        dest.data[i] = vec3_scale(dest.data[i], inv_det);
+    }
+    return dest;
+}
+
+// 2D affine transforms acting on homogeneous (x, y, 1) coordinates
+static inline Mat3 mat3_translation_2d(Vec2 t) {
+    Mat3 m = mat3_identity();
+    mat_get(m, 2, 0) = t.data[0];
+    mat_get(m, 2, 1) = t.data[1];
+    return m;
+}
+
+static inline Mat3 mat3_rotation_2d(float angle) {
+    float s = sinf(angle);
+    float c = cosf(angle);
+    return (Mat3){ {
+        { { c, s, 0.0f } },
+        { { -s, c, 0.0f } },
+        { { 0.0f, 0.0f, 1.0f } },
+    } };
+}
+
+static inline Mat3 mat3_scaling_2d(Vec2 s) {
+    Mat3 m = mat3_identity();
+    mat_get(m, 0, 0) = s.data[0];
+    mat_get(m, 1, 1) = s.data[1];
+    return m;
+}
+
+// Build the 2D affine transform `translate(x, y) * scale * rotate(angle)`
+// of `count` objects from structure of arrays streams, four at a time. The
+// transforms are written as packed Mat2x3 records `stride` bytes apart, so
+// `dest` can point straight into a mapped buffer, and `base_angle` is added
+// to every angle
+static inline void mat2x3_transform_batch(
+    void *dest,
+    size_t stride,
+    const float *angle,
+    const float *scale,
+    const float *x,
+    const float *y,
+    float base_angle,
+    size_t count
+) {
+    unsigned char *bytes = dest;
+    AvenGlmF4 base = aven_glm_f4_set1(base_angle);
+    for (size_t i = 0; i < count; i += 4) {
+        size_t n = min(count - i, (size_t)4);
+        float cos_lanes[4];
+        float sin_lanes[4];
+        float x_lanes[4];
+        float y_lanes[4];
+
+        // only the last group is partial, pad it so every lane is defined
+        AvenGlmF4 a;
+        AvenGlmF4 k;
+        if (n == 4) {
+            a = aven_glm_f4_load(angle + i);
+            k = aven_glm_f4_load(scale + i);
+            memcpy(x_lanes, x + i, sizeof(x_lanes));
+            memcpy(y_lanes, y + i, sizeof(y_lanes));
+        } else {
+            a = aven_glm_f4_load_n(angle + i, n);
+            k = aven_glm_f4_load_n(scale + i, n);
+            memcpy(x_lanes, x + i, n * sizeof(float));
+            memcpy(y_lanes, y + i, n * sizeof(float));
+        }
+
+        AvenGlmF4 s;
+        AvenGlmF4 c;
+        aven_glm_f4_sincos(aven_glm_f4_add(a, base), &s, &c);
+        aven_glm_f4_store(cos_lanes, aven_glm_f4_mul(c, k));
+        aven_glm_f4_store(sin_lanes, aven_glm_f4_mul(s, k));
+
+        // whole records are written in order and never read back, which
+        // suits write-combined memory
+        for (size_t j = 0; j < n; ++j) {
+            Mat2x3 transform = { {
+                { { cos_lanes[j], sin_lanes[j] } },
+                { { -sin_lanes[j], cos_lanes[j] } },
+                { { x_lanes[j], y_lanes[j] } },
+            } };
+            memcpy(bytes + (i + j) * stride, &transform, sizeof(transform));
+        }
+    }
+}
+
+static inline Mat4 mat4_identity(void) {
+    return (Mat4){ {
+        { { 1.0f, 0.0f, 0.0f, 0.0f } },
+        { { 0.0f, 1.0f, 0.0f, 0.0f } },
+        { { 0.0f, 0.0f, 1.0f, 0.0f } },
+        { { 0.0f, 0.0f, 0.0f, 1.0f } },
+    } };
+}
+
+static inline Mat4 mat4_mul_mat4(Mat4 a, Mat4 b) {
+    Mat4 dest;
+#if defined(AVEN_GLM_AVX)
+    // two columns of the result per 256-bit register, the in-lane permute
+    // splats an element of each of the two columns of `b` at once
+    __m256 a_cols[4];
+    for (size_t i = 0; i < 4; ++i) {
+        a_cols[i] = _mm256_broadcast_ps((const __m128 *)a.data[i].data);
+    }
+    for (size_t j = 0; j < 4; j += 2) {
+        __m256 b_cols = _mm256_loadu_ps(b.data[j].data);
+        __m256 col = _mm256_mul_ps(
+            a_cols[0],
+            _mm256_permute_ps(b_cols, 0x00)
+        );
+        col = _mm256_add_ps(
+            col,
+            _mm256_mul_ps(a_cols[1], _mm256_permute_ps(b_cols, 0x55))
+        );
+        col = _mm256_add_ps(
+            col,
+            _mm256_mul_ps(a_cols[2], _mm256_permute_ps(b_cols, 0xaa))
+        );
+        col = _mm256_add_ps(
+            col,
+            _mm256_mul_ps(a_cols[3], _mm256_permute_ps(b_cols, 0xff))
+        );
+        _mm256_storeu_ps(dest.data[j].data, col);
+    }
+#else
+    AvenGlmF4 a_cols[4];
+    for (size_t i = 0; i < 4; ++i) {
+        a_cols[i] = aven_glm_f4_load(a.data[i].data);
+    }
+    for (size_t j = 0; j < 4; ++j) {
+        AvenGlmF4 b_col = aven_glm_f4_load(b.data[j].data);
+        AvenGlmF4 col = aven_glm_f4_mul(
+            a_cols[0],
+            aven_glm_f4_splat(b_col, 0)
+        );
+        col = aven_glm_f4_madd(a_cols[1], aven_glm_f4_splat(b_col, 1), col);
+        col = aven_glm_f4_madd(a_cols[2], aven_glm_f4_splat(b_col, 2), col);
+        col = aven_glm_f4_madd(a_cols[3], aven_glm_f4_splat(b_col, 3), col);
+        aven_glm_f4_store(dest.data[j].data, col);
+    }
+#endif
+    return dest;
+}
+
+static inline Vec4 mat4_mul_vec4(Mat4 m, Vec4 v) {
+    AvenGlmF4 vv = aven_glm_f4_load(v.data);
+    AvenGlmF4 col = aven_glm_f4_mul(
+        aven_glm_f4_load(m.data[0].data),
+        aven_glm_f4_splat(vv, 0)
+    );
+    col = aven_glm_f4_madd(
+        aven_glm_f4_load(m.data[1].data),
+        aven_glm_f4_splat(vv, 1),
+        col
+    );
+    col = aven_glm_f4_madd(
+        aven_glm_f4_load(m.data[2].data),
+        aven_glm_f4_splat(vv, 2),
+        col
+    );
+    col = aven_glm_f4_madd(
+        aven_glm_f4_load(m.data[3].data),
+        aven_glm_f4_splat(vv, 3),
+        col
+    );
+    Vec4 dest;
+    aven_glm_f4_store(dest.data, col);
+    return dest;
+}
+
+static inline Mat4 mat4_transpose(Mat4 m) {
+    Mat4 dest;
+#if defined(AVEN_GLM_SSE)
+    __m128 c0 = _mm_loadu_ps(m.data[0].data);
+    __m128 c1 = _mm_loadu_ps(m.data[1].data);
+    __m128 c2 = _mm_loadu_ps(m.data[2].data);
+    __m128 c3 = _mm_loadu_ps(m.data[3].data);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    _mm_storeu_ps(dest.data[0].data, c0);
+    _mm_storeu_ps(dest.data[1].data, c1);
+    _mm_storeu_ps(dest.data[2].data, c2);
+    _mm_storeu_ps(dest.data[3].data, c3);
+#elif defined(AVEN_GLM_NEON)
+    float32x4x2_t t01 = vtrnq_f32(
+        vld1q_f32(m.data[0].data),
+        vld1q_f32(m.data[1].data)
+    );
+    float32x4x2_t t23 = vtrnq_f32(
+        vld1q_f32(m.data[2].data),
+        vld1q_f32(m.data[3].data)
+    );
+    vst1q_f32(
+        dest.data[0].data,
+        vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]))
+    );
+    vst1q_f32(
+        dest.data[1].data,
+        vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]))
+    );
+    vst1q_f32(
+        dest.data[2].data,
+        vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]))
+    );
+    vst1q_f32(
+        dest.data[3].data,
+        vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]))
+    );
+#else
+    for (size_t i = 0; i < 4; ++i) {
+        for (size_t j = 0; j < 4; ++j) {
+            mat_get(dest, i, j) = mat_get(m, j, i);
+        }
+    }
+#endif
+    return dest;
+}
+
+// The matrix must be invertible. The cofactors are built from the 2x2
+// minors of the upper and lower halves, only the final scale is vectorized
+static inline Mat4 mat4_inverse(Mat4 m) {
+    float a00 = mat_get(m, 0, 0);
+    float a01 = mat_get(m, 0, 1);
+    float a02 = mat_get(m, 0, 2);
+    float a03 = mat_get(m, 0, 3);
+    float a10 = mat_get(m, 1, 0);
+    float a11 = mat_get(m, 1, 1);
+    float a12 = mat_get(m, 1, 2);
+    float a13 = mat_get(m, 1, 3);
+    float a20 = mat_get(m, 2, 0);
+    float a21 = mat_get(m, 2, 1);
+    float a22 = mat_get(m, 2, 2);
+    float a23 = mat_get(m, 2, 3);
+    float a30 = mat_get(m, 3, 0);
+    float a31 = mat_get(m, 3, 1);
+    float a32 = mat_get(m, 3, 2);
+    float a33 = mat_get(m, 3, 3);
+
+    float b00 = a00 * a11 - a01 * a10;
+    float b01 = a00 * a12 - a02 * a10;
+    float b02 = a00 * a13 - a03 * a10;
+    float b03 = a01 * a12 - a02 * a11;
+    float b04 = a01 * a13 - a03 * a11;
+    float b05 = a02 * a13 - a03 * a12;
+    float b06 = a20 * a31 - a21 * a30;
+    float b07 = a20 * a32 - a22 * a30;
+    float b08 = a20 * a33 - a23 * a30;
+    float b09 = a21 * a32 - a22 * a31;
+    float b10 = a21 * a33 - a23 * a31;
+    float b11 = a22 * a33 - a23 * a32;
+
+    float det = b00 * b11 - b01 * b10 + b02 * b09 + b03 * b08 -
+        b04 * b07 + b05 * b06;
+
+    Mat4 adjugate = { {
+        { {
+            a11 * b11 - a12 * b10 + a13 * b09,
+            a02 * b10 - a01 * b11 - a03 * b09,
+            a31 * b05 - a32 * b04 + a33 * b03,
+            a22 * b04 - a21 * b05 - a23 * b03,
+        } },
+        { {
+            a12 * b08 - a10 * b11 - a13 * b07,
+            a00 * b11 - a02 * b08 + a03 * b07,
+            a32 * b02 - a30 * b05 - a33 * b01,
+            a20 * b05 - a22 * b02 + a23 * b01,
+        } },
+        { {
+            a10 * b10 - a11 * b08 + a13 * b06,
+            a01 * b08 - a00 * b10 - a03 * b06,
+            a30 * b04 - a31 * b02 + a33 * b00,
+            a21 * b02 - a20 * b04 - a23 * b00,
+        } },
+        { {
+            a11 * b07 - a10 * b09 - a12 * b06,
+            a00 * b09 - a01 * b07 + a02 * b06,
+            a31 * b01 - a30 * b03 - a32 * b00,
+            a20 * b03 - a21 * b01 + a22 * b00,
+        } },
+    } };
+
+    AvenGlmF4 inv_det = aven_glm_f4_set1(1.0f / det);
+    for (size_t i = 0; i < 4; ++i) {
+        aven_glm_f4_store(
+            adjugate.data[i].data,
+            aven_glm_f4_mul(aven_glm_f4_load(adjugate.data[i].data), inv_det)
+        );
+    }
+    return adjugate;
+}
+
+// 3D affine transforms acting on homogeneous (x, y, z, 1) coordinates
+static inline Mat4 mat4_translation(Vec3 t) {
+    Mat4 m = mat4_identity();
+    m.data[3] = (Vec4){ { t.data[0], t.data[1], t.data[2], 1.0f } };
+    return m;
+}
+
+static inline Mat4 mat4_scaling(Vec3 s) {
+    Mat4 m = mat4_identity();
+    mat_get(m, 0, 0) = s.data[0];
+    mat_get(m, 1, 1) = s.data[1];
+    mat_get(m, 2, 2) = s.data[2];
+    return m;
+}
+
+// Counter-clockwise rotation by `angle` radians about the unit `axis`
+static inline Mat4 mat4_rotation(Vec3 axis, float angle) {
+    float s = sinf(angle);
+    float c = cosf(angle);
+    float t = 1.0f - c;
+    float x = axis.data[0];
+    float y = axis.data[1];
+    float z = axis.data[2];
+    return (Mat4){ {
+        { { t * x * x + c, t * x * y + s * z, t * x * z - s * y, 0.0f } },
+        { { t * x * y - s * z, t * y * y + c, t * y * z + s * x, 0.0f } },
+        { { t * x * z + s * y, t * y * z - s * x, t * z * z + c, 0.0f } },
+        { { 0.0f, 0.0f, 0.0f, 1.0f } },
+    } };
+}
+
+// Right handed view space looking down -z with y up
+static inline Mat4 mat4_look_at(Vec3 eye, Vec3 center, Vec3 up) {
+    Vec3 f = vec3_normalize(vec3_sub(center, eye));
+    Vec3 s = vec3_normalize(vec3_cross(f, up));
+    Vec3 u = vec3_cross(s, f);
+    return (Mat4){ {
+        { { s.data[0], u.data[0], -f.data[0], 0.0f } },
+        { { s.data[1], u.data[1], -f.data[1], 0.0f } },
+        { { s.data[2], u.data[2], -f.data[2], 0.0f } },
+        { {
+            -vec3_dot(s, eye),
+            -vec3_dot(u, eye),
+            vec3_dot(f, eye),
+            1.0f,
+        } },
+    } };
+}
+
+// Projections from the view space above to Vulkan clip space, where y
+// points down and depth goes from 0 at `z_near` to 1 at `z_far`
+static inline Mat4 mat4_perspective(
+    float fov_y,
+    float aspect,
+    float z_near,
+    float z_far
+) {
+    float f = 1.0f / tanf(0.5f * fov_y);
+    return (Mat4){ {
+        { { f / aspect, 0.0f, 0.0f, 0.0f } },
+        { { 0.0f, -f, 0.0f, 0.0f } },
+        { { 0.0f, 0.0f, z_far / (z_near - z_far), -1.0f } },
+        { { 0.0f, 0.0f, z_near * z_far / (z_near - z_far), 0.0f } },
+    } };
+}
+
+static inline Mat4 mat4_orthographic(
+    float left,
+    float right,
+    float bottom,
+    float top,
+    float z_near,
+    float z_far
+) {
+    return (Mat4){ {
+        { { 2.0f / (right - left), 0.0f, 0.0f, 0.0f } },
+        { { 0.0f, -2.0f / (top - bottom), 0.0f, 0.0f } },
+        { { 0.0f, 0.0f, 1.0f / (z_near - z_far), 0.0f } },
+        { {
+            -(right + left) / (right - left),
+            (top + bottom) / (top - bottom),
+            z_near / (z_near - z_far),
+            1.0f,
+        } },
+    } };
+}
+
 #endif // AVEN_GLM_H
@@ -0,0 +1,30 @@
+#ifndef AVEN_THREAD_H
+#define AVEN_THREAD_H
+
+#include "aven.h"
+
+#include <pthread.h>
+
+// The GNU C __atomic builtins work on plain integer types, which keeps the
+// shared structs usable from C99 code without <stdatomic.h>
+
+#ifndef __GNUC__
+    #error "aven_thread.h requires the GNU C __atomic builtins"
+#endif
+
+#define atomic_load_relaxed(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define atomic_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define atomic_store_relaxed(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define atomic_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define atomic_exchange_acq_rel(p, v) __atomic_exchange_n( \
+        p, \
+        v, \
+        __ATOMIC_ACQ_REL \
+    )
+#define atomic_fetch_add_relaxed(p, v) __atomic_fetch_add( \
+        p, \
+        v, \
+        __ATOMIC_RELAXED \
+    )
+
+#endif // AVEN_THREAD_H
@@ -7,6 +7,7 @@
     #error "requires _POSIX_C_SOURCE >= 199309L"
 #endif
 
+#include <errno.h>
 #include <time.h>
 
 typedef struct timespec TimeSpec;
@@ -18,4 +19,29 @@ static int64_t timespec_diff(TimeSpec *end, TimeSpec *start) {
     return sec_diff + nsec_diff;
 }
 
+static void timespec_add(TimeSpec *t, int64_t nsec) {
+    int64_t total_nsec = (int64_t)t->tv_nsec + nsec;
+    int64_t seconds = total_nsec / (1000L * 1000L * 1000L);
+    total_nsec -= seconds * 1000L * 1000L * 1000L;
+    if (total_nsec < 0) {
+        total_nsec += 1000L * 1000L * 1000L;
+        seconds -= 1;
+    }
+    t->tv_sec += (time_t)seconds;
+    t->tv_nsec = (long)total_nsec;
+}
+
+static int timespec_now(TimeSpec *t) {
+    int error;
+    do {
+        error = clock_gettime(CLOCK_MONOTONIC, t);
+    } while (error == EINTR);
+    return error;
+}
+
+static void timespec_sleep_until(TimeSpec *t) {
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL) == EINTR) {
+    }
+}
+
 #endif // AVEN_TIME_H
@@ -5,6 +5,7 @@
 #endif
 #include "aven.h"
 #include "aven_glm.h"
+#include "aven_thread.h"
 #include "aven_time.h"
 
 #include <errno.h>
@@ -13,16 +14,34 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
+
 #define VOLK_IMPLEMENTATION
 #include <volk.h>
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
-#define MASTER_ARENA_SIZE 1024 * 1024 * 8
-#define SWAPCHAIN_ARENA_SIZE 1024
-#define MAX_FRAMES_IN_FLIGHT 2
-#define TIMESTEP_NS (4L * 1000L * 1000L)
+// The master arena only reserves address space, pages are committed as the
+// arena grows, so the reservation is sized generously
+#if SIZE_MAX > 0xffffffffU
+    #define MASTER_ARENA_SIZE ((size_t)16 * 1024 * 1024 * 1024)
+#else
+    #define MASTER_ARENA_SIZE ((size_t)512 * 1024 * 1024)
+#endif
+#define SWAPCHAIN_ARENA_SIZE (64 * 1024)
+// Reserved per scratch arena of every thread that records or loads
+#define SCRATCH_ARENA_SIZE ((size_t)64 * 1024 * 1024)
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+#define MAX_FRAMES_IN_FLIGHT 8
+// The simulation rate is independent of the display rate: rendering
+// interpolates between the two most recent ticks, so this can be lowered to
+// save CPU without making the motion choppy
+#ifndef TIMESTEP_NS
+    #define TIMESTEP_NS (1000L * 1000L * 1000L / 60L)
+#endif
 
 #ifdef ENABLE_VALIDATION_LAYERS
 const char *VALIDATION_LAYERS[] = {
@@ -37,6 +56,17 @@ const char *DEVICE_EXTENSIONS[] = {
 #endif
 };
 
+// Optional, used to measure when frames actually reach the display
+const char *PRESENT_WAIT_DEVICE_EXTENSIONS[] = {
+    VK_KHR_PRESENT_ID_EXTENSION_NAME,
+    VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+};
+
+// Optional, reports how much of each heap this process may use
+const char *MEMORY_BUDGET_DEVICE_EXTENSIONS[] = {
+    VK_EXT_MEMORY_BUDGET_EXTENSION_NAME,
+};
+
 typedef struct {
     Mat2 view;
 } UniformBufferObject;
@@ -53,6 +83,20 @@ const Vertex VERTICES[] = {
 
 typedef uint16_t Index;
 
+// Per draw placement of the square as structure of arrays streams, turned
+// into one transform per draw in the uniform ring each frame by a batch
+// kernel, the angle of a draw is relative to the game rotation
+typedef struct {
+    float *angle;
+    float *scale;
+    float *x;
+    float *y;
+    size_t len;
+} DrawStreams;
+
+// The linear part in the first two columns and the offset in the third
+typedef Mat2x3 DrawConstants;
+
 const Index INDICES[] = {
     0, 1, 2,
     0, 2, 3,
@@ -86,6 +130,7 @@ VkVertexInputAttributeDescription VERTEX_ATTRIBUTE_DESCRIPTIONS[] = {
 #define SQUARE_MAX_VELOCITY AVEN_GLM_PI_F
 #define SQUARE_ACCELERATION (AVEN_GLM_PI_F / 2.0f)
 #define SQUARE_STOP_ACCELERATION (15.0f * AVEN_GLM_PI_F)
+#define SQUARE_REST_VELOCITY (AVEN_GLM_PI_F / 1024.0f)
 
 typedef struct {
     float rotation_velocity;
@@ -95,15 +140,529 @@ typedef struct {
     bool done;
 } GameData;
 
+// The two most recent simulation states along with the scheduled time of
+// the newer tick, which is everything the renderer needs to interpolate
+typedef struct {
+    GameData previous;
+    GameData current;
+    TimeSpec time;
+} GameSnapshot;
+
+// Single producer, single consumer triple buffer: the simulation thread
+// writes into `back`, the renderer reads from `front`, and the two trade
+// slots through `middle` without ever blocking each other
+#define GAME_SNAPSHOT_BUFFER_INDEX_MASK 0x3U
+#define GAME_SNAPSHOT_BUFFER_FRESH_BIT 0x4U
+
+typedef struct {
+    GameSnapshot slots[3];
+    uint32_t back;
+    uint32_t middle;
+    uint32_t front;
+} GameSnapshotBuffer;
+
+// While the square is at rest and no direction key moves it the simulation
+// thread parks on `wake` instead of ticking, input signals it to resume
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    GameSnapshotBuffer snapshots;
+    int32_t input_direction;
+    uint32_t input_freeze;
+    uint32_t done;
+    int error;
+} Simulation;
+
+typedef enum {
+    FRAME_PACING_MIN_LATENCY = 0,
+    FRAME_PACING_MIN_POWER,
+    FRAME_PACING_FIXED_FPS,
+} FramePacingMode;
+
+const char *FRAME_PACING_MODE_NAMES[] = {
+    [FRAME_PACING_MIN_LATENCY] = "min-latency",
+    [FRAME_PACING_MIN_POWER] = "min-power",
+    [FRAME_PACING_FIXED_FPS] = "fixed-fps",
+};
+
+typedef enum {
+    FRAME_SYNC_TIMELINE = 0,
+    FRAME_SYNC_FENCES,
+} FrameSyncMode;
+
+typedef struct {
+    FramePacingMode pacing_mode;
+    FrameSyncMode sync_mode;
+    uint32_t fixed_fps;
+    uint32_t frames_in_flight;
+    uint32_t draw_count;
+    uint32_t record_threads;
+    size_t host_memory_cap;
+    bool huge_pages;
+    bool arena_stats;
+} AppOptions;
+
+// Time reserved between waking up and the predicted present deadline on
+// top of the measured CPU work, covering scheduler wakeup and GPU time.
+// With present timing the margin adapts between the two bounds depending
+// on whether frames make their deadline
+#define FRAME_PACER_MARGIN_NS (2L * 1000L * 1000L)
+#define FRAME_PACER_MIN_MARGIN_NS (500L * 1000L)
+#define FRAME_PACER_MARGIN_STEP_NS (100L * 1000L)
+#define FRAME_PACER_REPORT_NS (5L * 1000L * 1000L * 1000L)
+
+typedef struct {
+    FramePacingMode mode;
+    int64_t min_interval;
+    int64_t frame_interval;
+    int64_t work_estimate;
+    int64_t margin;
+    TimeSpec frame_start;
+    TimeSpec last_frame_end;
+    int64_t frame_start_cpu;
+
+    // set once present completion times are measured rather than estimated
+    bool present_timing;
+    bool has_last_present;
+    TimeSpec last_present;
+
+    TimeSpec report_start;
+    int64_t report_cpu_start;
+    int64_t report_work;
+    uint32_t report_frames;
+    int64_t report_latency;
+    uint32_t report_presents;
+    int64_t report_input_latency;
+    int64_t report_max_input_latency;
+    uint32_t report_inputs;
+} FramePacer;
+
+// A present that has been queued but not yet seen on the display
+typedef struct {
+    uint64_t id;
+    TimeSpec frame_start;
+    TimeSpec input_time;
+    bool has_input;
+} PendingPresent;
+
+#define MAX_PENDING_PRESENTS 16
+
+// What a resource's memory is used for, which decides the memory type
+typedef enum {
+    // only accessed by the GPU
+    MEMORY_USAGE_GPU_ONLY = 0,
+    // written once by the host, read by transfers
+    MEMORY_USAGE_UPLOAD,
+    // written by the GPU, read by the host
+    MEMORY_USAGE_READBACK,
+    // written by the host and read directly by shaders, ideally through a
+    // host visible window into device local memory
+    MEMORY_USAGE_DYNAMIC,
+    // attachments that never leave tile memory on tiled GPUs, which only
+    // back pages with physical memory when they are actually touched
+    MEMORY_USAGE_TRANSIENT,
+} MemoryUsage;
+
+typedef struct {
+    VkMemoryPropertyFlags required;
+    VkMemoryPropertyFlags preferred;
+    VkMemoryPropertyFlags avoided;
+} MemoryUsageInfo;
+
+const MemoryUsageInfo MEMORY_USAGE_INFOS[] = {
+    [MEMORY_USAGE_GPU_ONLY] = {
+        .required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        .avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    },
+    [MEMORY_USAGE_UPLOAD] = {
+        .required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        // leave the device local window to dynamic data
+        .avoided = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+    },
+    [MEMORY_USAGE_READBACK] = {
+        .required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        .preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    },
+    [MEMORY_USAGE_DYNAMIC] = {
+        .required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        .preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        .avoided = VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+    },
+    [MEMORY_USAGE_TRANSIENT] = {
+        .required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        .preferred = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+        .avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    },
+};
+
+// Every allocation is accounted to the category of the resource it backs
+typedef enum {
+    MEMORY_CATEGORY_GEOMETRY = 0,
+    MEMORY_CATEGORY_UNIFORM,
+    MEMORY_CATEGORY_STAGING,
+    MEMORY_CATEGORY_ATTACHMENT,
+    MEMORY_CATEGORY_COUNT,
+} MemoryCategory;
+
+const char *MEMORY_CATEGORY_NAMES[] = {
+    [MEMORY_CATEGORY_GEOMETRY] = "geometry",
+    [MEMORY_CATEGORY_UNIFORM] = "uniform",
+    [MEMORY_CATEGORY_STAGING] = "staging",
+    [MEMORY_CATEGORY_ATTACHMENT] = "attachment",
+};
+
+// Swapchain sized attachments are scaled back once a heap would go past
+// this share of its budget. Without VK_EXT_memory_budget the budget is
+// assumed to be a fixed share of the heap size
+#define MEMORY_BUDGET_PERCENT 90
+#define MEMORY_BUDGET_FALLBACK_PERCENT 80
+#define MEMORY_REPORT_NS (5L * 1000L * 1000L * 1000L)
+
+// Compiled pipelines are kept across runs in this file. Our own header in
+// front of the driver's data catches truncated or corrupted files, which
+// some drivers would otherwise accept without complaint
+#define PIPELINE_CACHE_FILE "pipeline_cache.bin"
+#define PIPELINE_CACHE_TEMP_FILE PIPELINE_CACHE_FILE ".tmp"
+#define PIPELINE_CACHE_MAGIC 0x31435056U
+
+typedef struct {
+    uint32_t magic;
+    uint32_t driver_version;
+    uint64_t data_size;
+    uint64_t data_hash;
+} PipelineCacheFileHeader;
+
+// Pipeline creation times split by whether the driver found the pipeline
+// in the cache, to compare cold and warm starts
+typedef struct {
+    VkPipelineCache cache;
+    size_t loaded_size;
+    uint32_t hits;
+    uint32_t misses;
+    int64_t hit_ns;
+    int64_t miss_ns;
+} PipelineCacheState;
+
+// Static geometry is only written straight into device memory when the
+// host visible part of device local memory is larger than the legacy 256 MiB
+// BAR window, e.g. with resizable BAR or on unified memory
+#define DIRECT_WRITE_MIN_HEAP_SIZE (256UL * 1024UL * 1024UL)
+
+// Device memory is reserved in large blocks per memory type and handed out
+// as aligned ranges. Each block keeps a list of ranges sorted by offset that
+// covers the whole block, so freed ranges merge with free neighbors
+#define DEVICE_MEMORY_BLOCK_SIZE (64UL * 1024UL * 1024UL)
+#define MAX_DEVICE_MEMORY_BLOCKS 32
+#define MAX_DEVICE_MEMORY_RANGES 256
+
+// Buffers and linear images must not share a bufferImageGranularity page
+// with optimally tiled images
+typedef enum {
+    MEMORY_RANGE_FREE = 0,
+    MEMORY_RANGE_LINEAR,
+    MEMORY_RANGE_OPTIMAL,
+} MemoryRangeKind;
+
+typedef struct {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    MemoryRangeKind kind;
+} MemoryRange;
+
+typedef struct {
+    VkDeviceMemory memory;
+    uint32_t memory_type_index;
+    VkDeviceSize size;
+    // host visible blocks stay mapped for their whole lifetime
+    unsigned char *mapped;
+    // holds a single resource and is released along with it
+    bool dedicated;
+    MemoryRange ranges[MAX_DEVICE_MEMORY_RANGES];
+    uint32_t range_count;
+} DeviceMemoryBlock;
+
+typedef struct {
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize granularity;
+    bool direct_write;
+    DeviceMemoryBlock *blocks;
+    uint32_t block_count;
+
+    // bytes handed out to resources and bytes held in blocks
+    VkDeviceSize category_usage[MEMORY_CATEGORY_COUNT];
+    VkDeviceSize category_peak[MEMORY_CATEGORY_COUNT];
+    VkDeviceSize heap_allocated[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize heap_reserved[VK_MAX_MEMORY_HEAPS];
+    // highest `heap_reserved`, the block bytes this allocator ever held
+    VkDeviceSize heap_reserved_peak[VK_MAX_MEMORY_HEAPS];
+} DeviceMemoryAllocator;
+
+typedef struct {
+    VkDeviceMemory memory;
+    uint32_t block_index;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void *mapped;
+    MemoryCategory category;
+} DeviceAllocation;
+
+// Swapchain sized attachments are created with their extent rounded up to a
+// size class and kept across resizes. Rendering is limited to the swapchain
+// extent, so a cached image at least that large is reused as is
+#define ATTACHMENT_SIZE_CLASS 256
+#define MAX_POOLED_ATTACHMENTS 4
+// don't reuse an image that is more than this many times the needed area
+#define ATTACHMENT_MAX_WASTE 2
+
+typedef struct {
+    VkImage image;
+    VkImageView view;
+    DeviceAllocation allocation;
+    VkFormat format;
+    VkExtent2D extent;
+    VkSampleCountFlagBits samples;
+    uint64_t last_used;
+} PooledAttachment;
+
+typedef struct {
+    PooledAttachment entries[MAX_POOLED_ATTACHMENTS];
+    uint32_t count;
+    uint32_t current;
+    uint64_t uses;
+} AttachmentPool;
+
+typedef struct {
+    // usage of the heap by this process as reported by the driver, or the
+    // memory held in blocks when VK_EXT_memory_budget is unavailable
+    VkDeviceSize usage;
+    VkDeviceSize budget;
+    VkDeviceSize reserved;
+    VkDeviceSize reserved_peak;
+    VkDeviceSize allocated;
+} MemoryHeapStats;
+
+typedef struct {
+    uint32_t heap_count;
+    MemoryHeapStats heaps[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize category_usage[MEMORY_CATEGORY_COUNT];
+    VkDeviceSize category_peak[MEMORY_CATEGORY_COUNT];
+} MemoryStats;
+
+// Space in a persistently mapped buffer is bump allocated and handed back in
+// allocation order once the GPU work that used it has completed
+typedef struct {
+    VkBuffer buffer;
+    DeviceAllocation allocation;
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+    VkDeviceSize head;
+    VkDeviceSize used;
+} BufferRing;
+
+// A buffer upload queued with upload_buffer, `data` has to stay valid until
+// the upload has been acquired by the graphics queue
+typedef struct {
+    VkBuffer buffer;
+    const void *data;
+    VkDeviceSize size;
+    VkDeviceSize uploaded;
+    VkPipelineStageFlags2 dst_stage;
+    VkAccessFlags2 dst_access;
+    // upload semaphore value of the submission copying the last chunk
+    uint64_t value;
+} BufferUpload;
+
+typedef struct {
+    VkCommandBuffer command_buffer;
+    uint64_t value;
+    VkDeviceSize staging_usage;
+} UploadSubmission;
+
+typedef Vec(BufferUpload *) BufferUploadVec;
+typedef Vec(VkBufferMemoryBarrier2) BufferBarrierVec;
+
+// Backs the pool of upload jobs and the lists, which only grow when more
+// uploads are outstanding than ever before
+#define UPLOAD_ARENA_SIZE (64 * 1024)
+#define MAX_UPLOAD_SUBMISSIONS 4
+#define STAGING_RING_SIZE (8UL * 1024UL * 1024UL)
+#define STAGING_RING_ALIGNMENT 16
+
+// Uploads from anywhere are coalesced into at most one submission per frame
+// on the transfer queue, copying through a persistent staging ring. Uploads
+// that do not fit are split into chunks over several submissions. Each
+// submission signals the next value of `semaphore`, which releases its part
+// of the ring. The graphics queue only waits on the semaphore in the first
+// frame recorded after an upload completed, so rendering never stalls on
+// data that is still streaming in
+typedef struct {
+    VkCommandPool command_pool;
+    VkSemaphore semaphore;
+    uint64_t submitted_value;
+    uint64_t completed_value;
+
+    BufferRing staging;
+    UploadSubmission submissions[MAX_UPLOAD_SUBMISSIONS];
+    uint32_t next_submission;
+
+    // every upload is taken from `pool` when it is queued and returned once
+    // the graphics queue has acquired its buffer. An upload is in exactly
+    // one of the lists, which all have room for every outstanding upload so
+    // moving between them never fails
+    Arena arena;
+    Pool pool;
+    BufferUploadVec queued;
+    BufferUploadVec in_flight;
+    BufferUploadVec acquiring;
+    BufferBarrierVec barriers;
+    uint64_t acquire_value;
+} UploadQueue;
+
+#define MAX_RECORD_THREADS 16
+#define MAX_DRAW_COUNT (1U << 20U)
+
+// Everything that is used by exactly one frame in flight at a time
+typedef struct {
+    // per frame and per draw constants are bump allocated from one
+    // persistently mapped uniform buffer ring and bound through dynamic
+    // offsets, so a single descriptor set serves every frame and draw. The
+    // draw constants of draw `i` are at
+    // `draw_constants_offset + i * draw_stride`
+    uint32_t frame_constants_offset;
+    uint32_t draw_constants_offset;
+    VkDeviceSize uniform_ring_usage;
+
+    VkCommandBuffer command_buffer;
+
+    // one pool per recording thread so that no pool is ever shared, reset
+    // as a whole by its owner once the frame is done on the GPU
+    VkCommandPool record_command_pools[MAX_RECORD_THREADS];
+    VkCommandBuffer secondary_command_buffers[MAX_RECORD_THREADS];
+
+    VkSemaphore image_available_semaphore;
+    VkSemaphore render_finished_semaphore;
+    VkFence in_flight_fence;
+
+    // frame counter value signaled once the GPU is done with this frame
+    uint64_t frame_value;
+} FrameData;
+
+typedef Slice(FrameData) FrameDataSlice;
+
+struct VulkanApp;
+
+// Thread 0 is the render thread itself, the others are started with the
+// main loop and each record one slice of the draw list per frame
+typedef struct {
+    pthread_t thread;
+    struct VulkanApp *app;
+    uint32_t index;
+    // the generation when the thread was started, so a frame kicked off
+    // before the thread first takes the mutex is still recorded
+    uint32_t generation;
+} RecordWorker;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    RecordWorker workers[MAX_RECORD_THREADS];
+    uint32_t thread_count;
+    uint32_t started;
+    uint32_t generation;
+    uint32_t pending;
+    bool done;
+    FrameData *frame;
+    int error;
+} RecordThreads;
+
+// Driver host memory goes through these callbacks so it can be measured and
+// capped. Command scope allocations only live for a single Vulkan call, so
+// they are bump allocated from an arena that is rewound whenever nothing in
+// it is live anymore. Object scope allocations are rounded up to a power of
+// two size class and recycled through a free list per class, with new
+// blocks carved from a second arena. Other scopes, over-aligned requests
+// and whatever doesn't fit go to the C heap
+#define HOST_ARENA_SIZE (256 * 1024)
+#define HOST_ARENA_MAX_ALIGNMENT 32
+#define HOST_OBJECT_ARENA_SIZE (1024 * 1024)
+// the size classes go from 64 bytes to 8 KiB
+#define HOST_SIZE_CLASS_MIN_SHIFT 6
+#define HOST_SIZE_CLASS_COUNT 8
+#define HOST_SCOPE_COUNT (VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1)
+
+const char *HOST_SCOPE_NAMES[] = {
+    [VK_SYSTEM_ALLOCATION_SCOPE_COMMAND] = "command",
+    [VK_SYSTEM_ALLOCATION_SCOPE_OBJECT] = "object",
+    [VK_SYSTEM_ALLOCATION_SCOPE_CACHE] = "cache",
+    [VK_SYSTEM_ALLOCATION_SCOPE_DEVICE] = "device",
+    [VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE] = "instance",
+};
+
+typedef struct {
+    uint64_t allocations;
+    uint64_t arena_allocations;
+    uint64_t failures;
+    uint64_t live;
+    size_t bytes;
+    size_t peak_bytes;
+    // reported by the driver through the internal allocation notifications
+    size_t internal_bytes;
+} HostScopeStats;
+
+typedef struct {
+    Arena arena;
+    Arena base_arena;
+    uint64_t live;
+} HostArena;
+
+typedef struct {
+    VkAllocationCallbacks callbacks;
+    pthread_mutex_t mutex;
+    HostArena command_arena;
+    Arena object_arena;
+    // freed blocks of each size class, linked through their first bytes
+    void *free_blocks[HOST_SIZE_CLASS_COUNT];
+    // 0 for no limit
+    size_t cap;
+    size_t bytes;
+    HostScopeStats scopes[HOST_SCOPE_COUNT];
+} HostAllocator;
+
+typedef enum {
+    HOST_BLOCK_HEAP,
+    HOST_BLOCK_COMMAND_ARENA,
+    HOST_BLOCK_SIZE_CLASS,
+} HostBlockSource;
+
+// Stored in front of every allocation, `block` is the start of the memory
+// the allocation was placed in
+typedef struct {
+    void *block;
+    size_t size;
+    uint32_t scope;
+    uint32_t source;
+    uint32_t size_class;
+} HostAllocationHeader;
+
 typedef Slice(VkImage) VkImageSlice;
 typedef Slice(VkImageView) VkImageViewSlice;
 
-typedef struct {
+typedef struct VulkanApp {
     uint32_t width;
     uint32_t height;
 
     GLFWwindow *window;
 
+    HostAllocator host_allocator;
+    // passed to every Vulkan call that takes allocation callbacks
+    const VkAllocationCallbacks *allocator;
+
     VkInstance instance;
 
 #ifdef ENABLE_VALIDATION_LAYERS
@@ -116,54 +675,94 @@ typedef struct {
 
     VkQueue graphics_queue;
     VkQueue present_queue;
+    VkQueue transfer_queue;
+    uint32_t graphics_family;
+    uint32_t transfer_family;
 
     VkSwapchainKHR swapchain;
 
     VkImageSlice swapchain_images;
     VkImageViewSlice swapchain_image_views;
     Arena base_swapchain_arena;
+    ArenaStats swapchain_arena_stats;
 
     VkFormat swapchain_image_format;
     VkExtent2D swapchain_extent;
 
+    // the multisampled color attachment, taken from `attachments`
+    AttachmentPool attachments;
     VkImage color_image;
-    VkDeviceMemory color_image_memory;
     VkImageView color_image_view;
+    // completed frame value after which the transient memory is reported
+    uint64_t transient_report_value;
 
     VkDescriptorSetLayout descriptor_set_layout;
     VkPipelineLayout pipeline_layout;
     VkPipeline graphics_pipeline;
+    PipelineCacheState pipeline_cache;
 
     VkBuffer vertex_buffer;
-    VkDeviceMemory vertex_buffer_memory;
+    DeviceAllocation vertex_buffer_allocation;
     VkBuffer index_buffer;
-    VkDeviceMemory index_buffer_memory;
-
-    VkBuffer uniform_buffers[MAX_FRAMES_IN_FLIGHT];
-    VkDeviceMemory uniform_buffers_memory[MAX_FRAMES_IN_FLIGHT];
-    void *uniform_buffers_mapped[MAX_FRAMES_IN_FLIGHT];
+    DeviceAllocation index_buffer_allocation;
 
     VkDescriptorPool descriptor_pool;
-    VkDescriptorSet descriptor_sets[MAX_FRAMES_IN_FLIGHT];
-
+    VkDescriptorSet descriptor_set;
     VkCommandPool command_pool;
-    VkCommandBuffer command_buffers[MAX_FRAMES_IN_FLIGHT];
 
-    VkSemaphore image_available_semaphores[MAX_FRAMES_IN_FLIGHT];
-    VkSemaphore render_finished_semaphores[MAX_FRAMES_IN_FLIGHT];
-    VkFence in_flight_fences[MAX_FRAMES_IN_FLIGHT];
+    BufferRing uniform_ring;
+    VkDeviceSize draw_stride;
+
+    DeviceMemoryAllocator device_memory;
+    UploadQueue uploads;
+    bool geometry_ready;
+
+    FrameDataSlice frames;
+    DrawStreams draws;
+    RecordThreads record_threads;
 
+    // Every submitted frame bumps `frame_counter`, and anything the GPU
+    // might still be reading is released once `completed_frame` reaches the
+    // value it was last used with. In FRAME_SYNC_TIMELINE mode the counter
+    // is a single timeline semaphore, otherwise it is derived from fences
+    VkSemaphore frame_timeline;
+    uint64_t frame_counter;
+    uint64_t completed_frame;
+
+    // lowered below the device maximum while memory is tight
     VkSampleCountFlagBits msaa_samples;
+    VkSampleCountFlagBits max_msaa_samples;
 
     uint32_t current_frame;
     bool framebuffer_resized;
-
-    GameData game_data;
+    bool redraw_requested;
+    bool iconified;
+    bool presented_static_frame;
+
+    Simulation simulation;
+    FramePacer pacer;
+
+    // time of the oldest key event not yet picked up by a frame
+    TimeSpec input_time;
+    bool input_pending;
+    TimeSpec frame_input_time;
+    bool frame_has_input;
+
+    bool present_wait_supported;
+    bool memory_budget_supported;
+    TimeSpec memory_report_start;
+    uint64_t present_id;
+    PendingPresent pending_presents[MAX_PENDING_PRESENTS];
+    uint32_t pending_present_head;
+    uint32_t pending_present_count;
+
+    AppOptions options;
 } VulkanApp;
 
 typedef enum {
     APP_ERROR_NONE = 0,
-    APP_ERROR_MAIN_MALLOC,
+    APP_ERROR_MAIN_RESERVE,
+    APP_ERROR_MAIN_ARGS,
     APP_ERROR_INIT_WINDOW,
     APP_ERROR_INIT_VULKAN_VOLK,
     APP_ERROR_CREATE_INSTANCE_ALLOC,
@@ -175,6 +774,7 @@ typedef enum {
     APP_ERROR_PICK_PHYSICAL_DEVICE_ENUMERATE,
     APP_ERROR_PICK_PHYSICAL_DEVICE_ALLOC,
     APP_ERROR_PICK_PHYSICAL_DEVICE_SUITABLE,
+    APP_ERROR_CREATE_LOGICAL_DEVICE_ALLOC,
     APP_ERROR_CREATE_LOGICAL_DEVICE,
     APP_ERROR_CREATE_SWAP_CHAIN_CREATE,
     APP_ERROR_CREATE_SWAP_CHAIN_ALLOC,
@@ -189,31 +789,61 @@ typedef enum {
     APP_ERROR_CREATE_RENDER_PASS,
     APP_ERROR_CREATE_GRAPHICS_PIPELINE_LAYOUT,
     APP_ERROR_CREATE_GRAPHICS_PIPELINE_CREATE,
+    APP_ERROR_CREATE_PIPELINE_CACHE,
+    APP_ERROR_SAVE_PIPELINE_CACHE_DATA,
+    APP_ERROR_SAVE_PIPELINE_CACHE_ALLOC,
+    APP_ERROR_SAVE_PIPELINE_CACHE_WRITE,
+    APP_ERROR_SAVE_PIPELINE_CACHE_RENAME,
     APP_ERROR_CREATE_FRAMEBUFFER_ALLOC,
     APP_ERROR_CREATE_FRAMEBUFFER_CREATE,
     APP_ERROR_CREATE_COMMAND_POOL,
+    APP_ERROR_CREATE_COMMAND_BUFFER_ALLOC,
     APP_ERROR_CREATE_COMMAND_BUFFER,
     APP_ERROR_RECORD_COMMAND_BUFFER_BEGIN,
     APP_ERROR_RECORD_COMMAND_BUFFER_END,
+    APP_ERROR_RECORD_THREADS_START,
     APP_ERROR_CREATE_SYNC_OBJECTS_AVAILABLE,
     APP_ERROR_CREATE_SYNC_OBJECTS_FINISHED,
     APP_ERROR_CREATE_SYNC_OBJECTS_FENCE,
+    APP_ERROR_CREATE_SYNC_OBJECTS_TIMELINE,
+    APP_ERROR_WAIT_FOR_FRAME,
     APP_ERROR_DRAW_FRAME_FENCE,
     APP_ERROR_DRAW_FRAME_SWAPCHAIN,
     APP_ERROR_DRAW_FRAME_SUBMIT,
     APP_ERROR_FIND_MEMORY_TYPE,
+    APP_ERROR_DEVICE_MEMORY_ALLOC,
+    APP_ERROR_DEVICE_MEMORY_MAP,
+    APP_ERROR_DEVICE_MEMORY_BLOCKS,
+    APP_ERROR_DEVICE_MEMORY_BIND,
     APP_ERROR_CREATE_BUFFER_CREATE,
     APP_ERROR_CREATE_BUFFER_MEMORY,
-    APP_ERROR_COPY_BUFFER_ALLOCATE,
-    APP_ERROR_COPY_BUFFER_COMMAND,
-    APP_ERROR_COPY_BUFFER_SUBMIT,
+    APP_ERROR_CREATE_UPLOAD_QUEUE_POOL,
+    APP_ERROR_CREATE_UPLOAD_QUEUE_ALLOCATE,
+    APP_ERROR_CREATE_UPLOAD_QUEUE_SEMAPHORE,
+    APP_ERROR_UPLOAD_BUFFER_FULL,
+    APP_ERROR_UPLOAD_BUFFER_ALLOC,
+    APP_ERROR_FLUSH_UPLOADS_COMMAND,
+    APP_ERROR_FLUSH_UPLOADS_SUBMIT,
+    APP_ERROR_POLL_UPLOADS,
     APP_ERROR_CREATE_DESCRIPTOR_SET_LAYOUT,
     APP_ERROR_CREATE_DESCRIPTOR_POOL,
     APP_ERROR_CREATE_DESCRIPTOR_SETS,
+    APP_ERROR_BUFFER_RING_FULL,
     APP_ERROR_CREATE_COLOR_RESOURCES_CREATE,
     APP_ERROR_CREATE_COLOR_RESOURCES_ALLOC,
     APP_ERROR_MAIN_LOOP_CLOCK,
+    APP_ERROR_SIMULATION_START,
+    APP_ERROR_SIMULATION_CLOCK,
+    APP_ERROR_FRAME_PACER_CLOCK,
+    APP_ERROR_WAIT_FOR_PRESENT,
     APP_ERROR_RUN_TIME,
+    APP_ERROR_ALLOCATE_FRAMES_ALLOC,
+    APP_ERROR_ALLOCATE_DRAWS_ALLOC,
+    APP_ERROR_ALLOCATE_MEMORY_BLOCKS_ALLOC,
+    APP_ERROR_HOST_ALLOCATOR_ALLOC,
+    APP_ERROR_HOST_ALLOCATOR_MUTEX,
+    APP_ERROR_SCRATCH_INIT,
+    APP_ERROR_CMD_DRAW_RANGE_ALLOC,
 #ifdef ENABLE_VALIDATION_LAYERS
     APP_ERROR_CHECK_VALIDATION_LAYER_SUPPORT_ALLOC,
     APP_ERROR_SETUP_DEBUG_MESSENGER,
@@ -221,12 +851,342 @@ typedef enum {
 #endif // ENABLE_VALIDATION_LAYERS
 } VulkanAppError;
 
+static void host_allocator_free_locked(HostAllocator *allocator, void *memory) {
+    HostAllocationHeader header;
+    memcpy(
+        &header,
+        (unsigned char *)memory - sizeof(header),
+        sizeof(header)
+    );
+
+    HostScopeStats *stats = &allocator->scopes[header.scope];
+    stats->live -= 1;
+    stats->bytes -= header.size;
+    allocator->bytes -= header.size;
+
+    if (header.source == HOST_BLOCK_HEAP) {
+        free(header.block);
+        return;
+    }
+
+    if (header.source == HOST_BLOCK_SIZE_CLASS) {
+        void **free_blocks = &allocator->free_blocks[header.size_class];
+        memcpy(header.block, free_blocks, sizeof(*free_blocks));
+        *free_blocks = header.block;
+        return;
+    }
+
+    HostArena *arena = &allocator->command_arena;
+    arena->live -= 1;
+    if (arena->live == 0) {
+        arena->arena = arena->base_arena;
+    }
+}
+
+// A block of the smallest size class that holds `size` bytes, reused from
+// the free list of the class if possible. Returns NULL if the size is above
+// every class or the object arena is full
+static unsigned char *host_allocator_size_class_alloc(
+    HostAllocator *allocator,
+    size_t size,
+    uint32_t *size_class
+) {
+    uint32_t index = 0;
+    while (((size_t)1 << (HOST_SIZE_CLASS_MIN_SHIFT + index)) < size) {
+        index += 1;
+        if (index == HOST_SIZE_CLASS_COUNT) {
+            return NULL;
+        }
+    }
+    *size_class = index;
+
+    unsigned char *block = allocator->free_blocks[index];
+    if (block != NULL) {
+        memcpy(&allocator->free_blocks[index], block, sizeof(void *));
+        return block;
+    }
+
+    return arena_alloc(
+        &allocator->object_arena,
+        (size_t)1 << (HOST_SIZE_CLASS_MIN_SHIFT + index),
+        HOST_ARENA_MAX_ALIGNMENT
+    );
+}
+
+// `replaced` is the size of an allocation that is freed once this one
+// succeeds, which doesn't count against the cap
+static void *host_allocator_alloc_locked(
+    HostAllocator *allocator,
+    size_t size,
+    size_t alignment,
+    VkSystemAllocationScope scope,
+    size_t replaced
+) {
+    HostScopeStats *stats = &allocator->scopes[scope];
+    if (
+        allocator->cap != 0 and
+        allocator->bytes - replaced + size > allocator->cap
+    ) {
+        stats->failures += 1;
+        return NULL;
+    }
+
+    // the header sits right below the returned pointer
+    alignment = max(alignment, (size_t)16);
+    size_t offset = (sizeof(HostAllocationHeader) + alignment - 1) &
+        ~(alignment - 1);
+    HostAllocationHeader header = {
+        .size = size,
+        .scope = (uint32_t)scope,
+    };
+
+    // arena blocks are aligned at least as much as the allocation, so the
+    // allocation sits right after the header
+    unsigned char *memory = NULL;
+    if (alignment <= HOST_ARENA_MAX_ALIGNMENT) {
+        unsigned char *block = NULL;
+        if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+            HostArena *arena = &allocator->command_arena;
+            block = arena_alloc(&arena->arena, offset + size, alignment);
+            if (block != NULL) {
+                arena->live += 1;
+                header.source = HOST_BLOCK_COMMAND_ARENA;
+            }
+        } else if (scope == VK_SYSTEM_ALLOCATION_SCOPE_OBJECT) {
+            block = host_allocator_size_class_alloc(
+                allocator,
+                offset + size,
+                &header.size_class
+            );
+            if (block != NULL) {
+                header.source = HOST_BLOCK_SIZE_CLASS;
+            }
+        }
+        if (block != NULL) {
+            header.block = block;
+            memory = block + offset;
+            stats->arena_allocations += 1;
+        }
+    }
+    if (memory == NULL) {
+        header.source = HOST_BLOCK_HEAP;
+        header.block = malloc(offset + size + alignment - 1);
+        if (header.block == NULL) {
+            stats->failures += 1;
+            return NULL;
+        }
+        uintptr_t address = (uintptr_t)header.block + offset;
+        memory = (unsigned char *)header.block +
+            (((address + alignment - 1) & ~(uintptr_t)(alignment - 1)) -
+            (uintptr_t)header.block);
+    }
+    memcpy(memory - sizeof(header), &header, sizeof(header));
+
+    stats->allocations += 1;
+    stats->live += 1;
+    stats->bytes += size;
+    stats->peak_bytes = max(stats->peak_bytes, stats->bytes);
+    allocator->bytes += size;
+
+    return memory;
+}
+
+static void *VKAPI_PTR host_allocation(
+    void *user_data,
+    size_t size,
+    size_t alignment,
+    VkSystemAllocationScope scope
+) {
+    HostAllocator *allocator = user_data;
+    pthread_mutex_lock(&allocator->mutex);
+    void *memory = host_allocator_alloc_locked(
+        allocator,
+        size,
+        alignment,
+        scope,
+        0
+    );
+    pthread_mutex_unlock(&allocator->mutex);
+    return memory;
+}
+
+static void *VKAPI_PTR host_reallocation(
+    void *user_data,
+    void *original,
+    size_t size,
+    size_t alignment,
+    VkSystemAllocationScope scope
+) {
+    HostAllocator *allocator = user_data;
+    pthread_mutex_lock(&allocator->mutex);
+
+    void *memory = NULL;
+    if (original == NULL) {
+        memory = host_allocator_alloc_locked(
+            allocator,
+            size,
+            alignment,
+            scope,
+            0
+        );
+    } else if (size == 0) {
+        host_allocator_free_locked(allocator, original);
+    } else {
+        // blocks are never grown in place
+        HostAllocationHeader header;
+        memcpy(
+            &header,
+            (unsigned char *)original - sizeof(header),
+            sizeof(header)
+        );
+        memory = host_allocator_alloc_locked(
+            allocator,
+            size,
+            alignment,
+            scope,
+            header.size
+        );
+        if (memory != NULL) {
+            memcpy(memory, original, min(size, header.size));
+            host_allocator_free_locked(allocator, original);
+        }
+    }
+
+    pthread_mutex_unlock(&allocator->mutex);
+    return memory;
+}
+
+static void VKAPI_PTR host_free(void *user_data, void *memory) {
+    if (memory == NULL) {
+        return;
+    }
+
+    HostAllocator *allocator = user_data;
+    pthread_mutex_lock(&allocator->mutex);
+    host_allocator_free_locked(allocator, memory);
+    pthread_mutex_unlock(&allocator->mutex);
+}
+
+static void VKAPI_PTR host_internal_allocation(
+    void *user_data,
+    size_t size,
+    VkInternalAllocationType type,
+    VkSystemAllocationScope scope
+) {
+    (void)type;
+    HostAllocator *allocator = user_data;
+    pthread_mutex_lock(&allocator->mutex);
+    allocator->scopes[scope].internal_bytes += size;
+    pthread_mutex_unlock(&allocator->mutex);
+}
+
+static void VKAPI_PTR host_internal_free(
+    void *user_data,
+    size_t size,
+    VkInternalAllocationType type,
+    VkSystemAllocationScope scope
+) {
+    (void)type;
+    HostAllocator *allocator = user_data;
+    pthread_mutex_lock(&allocator->mutex);
+    allocator->scopes[scope].internal_bytes -= size;
+    pthread_mutex_unlock(&allocator->mutex);
+}
+
+// The allocator must stay at the same address while it is in use
+static int host_allocator_init(
+    HostAllocator *allocator,
+    Arena *arena,
+    size_t cap
+) {
+    *allocator = (HostAllocator){
+        .callbacks = {
+            .pUserData = allocator,
+            .pfnAllocation = host_allocation,
+            .pfnReallocation = host_reallocation,
+            .pfnFree = host_free,
+            .pfnInternalAllocation = host_internal_allocation,
+            .pfnInternalFree = host_internal_free,
+        },
+        .cap = cap,
+    };
+
+    void *memory = arena_alloc(arena, HOST_ARENA_SIZE, 16);
+    if (memory == NULL) {
+        return APP_ERROR_HOST_ALLOCATOR_ALLOC;
+    }
+    allocator->command_arena.arena = arena_init(memory, HOST_ARENA_SIZE);
+    allocator->command_arena.base_arena = allocator->command_arena.arena;
+
+    memory = arena_alloc(
+        arena,
+        HOST_OBJECT_ARENA_SIZE,
+        HOST_ARENA_MAX_ALIGNMENT
+    );
+    if (memory == NULL) {
+        return APP_ERROR_HOST_ALLOCATOR_ALLOC;
+    }
+    allocator->object_arena = arena_init(memory, HOST_OBJECT_ARENA_SIZE);
+
+    if (pthread_mutex_init(&allocator->mutex, NULL) != 0) {
+        return APP_ERROR_HOST_ALLOCATOR_MUTEX;
+    }
+
+    return 0;
+}
+
+static void host_allocator_report(HostAllocator *allocator) {
+    printf("host memory by allocation scope:\n");
+    for (uint32_t i = 0; i < HOST_SCOPE_COUNT; ++i) {
+        HostScopeStats *stats = &allocator->scopes[i];
+        printf(
+            "  %-8s %8llu allocations (%llu from arenas, %llu failed),"
+                " %.1f KiB peak, %.1f KiB live, %.1f KiB internal\n",
+            HOST_SCOPE_NAMES[i],
+            (unsigned long long)stats->allocations,
+            (unsigned long long)stats->arena_allocations,
+            (unsigned long long)stats->failures,
+            (double)stats->peak_bytes / 1024.0,
+            (double)stats->bytes / 1024.0,
+            (double)stats->internal_bytes / 1024.0
+        );
+    }
+}
+
+static void host_allocator_cleanup(HostAllocator *allocator) {
+    pthread_mutex_destroy(&allocator->mutex);
+}
+
 void framebuffer_resize_callback(GLFWwindow *window, int width, int height) {
     (void)width;
     (void)height;
 
     VulkanApp *app = glfwGetWindowUserPointer(window);
     app->framebuffer_resized = true;
+    app->redraw_requested = true;
+}
+
+void window_refresh_callback(GLFWwindow *window) {
+    VulkanApp *app = glfwGetWindowUserPointer(window);
+    app->redraw_requested = true;
+}
+
+void window_iconify_callback(GLFWwindow *window, int iconified) {
+    VulkanApp *app = glfwGetWindowUserPointer(window);
+    app->iconified = iconified == GLFW_TRUE;
+    app->redraw_requested = true;
+}
+
+static void simulation_wake(Simulation *simulation) {
+    pthread_mutex_lock(&simulation->mutex);
+    pthread_cond_signal(&simulation->wake);
+    pthread_mutex_unlock(&simulation->mutex);
+}
+
+// A held direction key only turns the square while freeze isn't held
+static bool simulation_input_moving(Simulation *simulation) {
+    return atomic_load_relaxed(&simulation->input_direction) != 0 and
+        atomic_load_relaxed(&simulation->input_freeze) == 0;
 }
 
 void key_callback(
@@ -247,26 +1207,37 @@ void key_callback(
     }
 
     VulkanApp *app = glfwGetWindowUserPointer(window);
+    Simulation *simulation = &app->simulation;
     switch (key) {
         case GLFW_KEY_A:
         case GLFW_KEY_LEFT:
-            app->game_data.direction += scale * 1;
+            atomic_fetch_add_relaxed(&simulation->input_direction, scale * 1);
             break;
         case GLFW_KEY_D:
         case GLFW_KEY_RIGHT:
-            app->game_data.direction += scale * (-1);
+            atomic_fetch_add_relaxed(
+                &simulation->input_direction,
+                scale * (-1)
+            );
             break;
         case GLFW_KEY_SPACE:
             if (scale > 0) {
-                app->game_data.freeze = true;
+                atomic_store_relaxed(&simulation->input_freeze, 1U);
             }
             if (scale < 0) {
-                app->game_data.freeze = false;
+                atomic_store_relaxed(&simulation->input_freeze, 0U);
             }
             break;
         default:
-            break;
+            return;
+    }
+
+    if (!app->input_pending and timespec_now(&app->input_time) == 0) {
+        app->input_pending = true;
     }
+
+    app->redraw_requested = true;
+    simulation_wake(simulation);
 }
 
 static int init_window(VulkanApp *app) {
@@ -287,6 +1258,8 @@ static int init_window(VulkanApp *app) {
     glfwSetWindowUserPointer(app->window, app);
     glfwSetFramebufferSizeCallback(app->window, framebuffer_resize_callback);
     glfwSetKeyCallback(app->window, key_callback);
+    glfwSetWindowRefreshCallback(app->window, window_refresh_callback);
+    glfwSetWindowIconifyCallback(app->window, window_iconify_callback);
 
     return 0;
 }
@@ -368,7 +1341,7 @@ static int setup_debug_messenger(VulkanApp *app) {
     VkResult result = vkCreateDebugUtilsMessengerEXT(
         app->instance,
         &create_info,
-        NULL,
+        app->allocator,
         &app->debug_messenger
     );
     if (result != VK_SUCCESS) {
@@ -445,7 +1418,11 @@ static int create_instance(VulkanApp *app, Arena temp_arena) {
 #endif // ENABLE_VALIDATION_LAYERS
     };
 
-    VkResult result = vkCreateInstance(&create_info, NULL, &app->instance);
+    VkResult result = vkCreateInstance(
+        &create_info,
+        app->allocator,
+        &app->instance
+    );
     if (result != VK_SUCCESS) {
         return APP_ERROR_CREATE_INSTANCE_CREATE;
     }
@@ -459,7 +1436,7 @@ static int create_surface(VulkanApp *app) {
     VkResult result = glfwCreateWindowSurface(
         app->instance,
         app->window,
-        NULL,
+        app->allocator,
         &app->surface
     );
     if (result != VK_SUCCESS) {
@@ -472,6 +1449,8 @@ static int create_surface(VulkanApp *app) {
 typedef struct {
     Optional(uint32_t) graphics_family;
     Optional(uint32_t) present_family;
+    // only set when there is a transfer family without graphics support
+    Optional(uint32_t) transfer_family;
 } QueueFamilyIndices;
 
 typedef Result(QueueFamilyIndices) QueueFamilyIndicesResult;
@@ -525,20 +1504,36 @@ static QueueFamilyIndicesResult find_queue_families(
         }
     }
 
+    // transfer-only families usually map to dedicated copy engines that run
+    // alongside graphics work
+    for (uint32_t i = 0; i < queue_family_count; ++i) {
+        VkQueueFlags flags = queue_families[i].queueFlags;
+        if (
+            (flags & VK_QUEUE_TRANSFER_BIT) != 0 and
+            (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0
+        ) {
+            indices.transfer_family.value = i;
+            indices.transfer_family.valid = true;
+            break;
+        }
+    }
+
     return (QueueFamilyIndicesResult){ .payload = indices };
 }
 
 static BoolResult check_device_extension_support(
     VkPhysicalDevice device,
+    const char **extensions,
+    size_t extension_count,
     Arena temp_arena
 ) {
-    uint32_t extension_count;
-    vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, NULL);
+    uint32_t available_count;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &available_count, NULL);
 
     VkExtensionProperties *available_extensions = arena_create_array(
         VkExtensionProperties,
         &temp_arena,
-        extension_count
+        available_count
     );
     if (available_extensions == NULL) {
         return (BoolResult){
@@ -549,15 +1544,15 @@ static BoolResult check_device_extension_support(
     vkEnumerateDeviceExtensionProperties(
         device,
         NULL,
-        &extension_count,
+        &available_count,
         available_extensions
     );
 
-    for (size_t j = 0; j < countof(DEVICE_EXTENSIONS); ++j) {
+    for (size_t j = 0; j < extension_count; ++j) {
         bool extension_found = false;
-        for (uint32_t i = 0; i < extension_count; ++i) {
+        for (uint32_t i = 0; i < available_count; ++i) {
             int diff = strcmp(
-                DEVICE_EXTENSIONS[j],
+                extensions[j],
                 available_extensions[i].extensionName
             );
             if (diff == 0) {
@@ -683,6 +1678,8 @@ static BoolResult is_device_suitable(
     {
         BoolResult result = check_device_extension_support(
             device,
+            DEVICE_EXTENSIONS,
+            countof(DEVICE_EXTENSIONS),
             temp_arena
         );
         if (result.error != 0 or !result.payload) {
@@ -757,7 +1754,8 @@ static int pick_physical_device(VulkanApp *app, Arena temp_arena) {
 
         if (result.payload) {
             app->physical_device = devices[i];
-            app->msaa_samples = get_max_sample_count(app);
+            app->max_msaa_samples = get_max_sample_count(app);
+            app->msaa_samples = app->max_msaa_samples;
             break;
         }
     }
@@ -785,17 +1783,26 @@ static int create_logical_device(VulkanApp *app, Arena temp_arena) {
     }
     assert(indices.graphics_family.valid and indices.present_family.valid);
 
-    uint32_t queue_families[] = {
-        indices.graphics_family.value,
-        indices.present_family.value
-    };
-    uint32_t queue_family_count = 2;
-    if (indices.graphics_family.value == indices.present_family.value) {
-        queue_family_count = 1;
+    app->graphics_family = indices.graphics_family.value;
+    app->transfer_family = indices.graphics_family.value;
+    if (indices.transfer_family.valid) {
+        app->transfer_family = indices.transfer_family.value;
+    }
+
+    uint32_t queue_families[3] = { indices.graphics_family.value };
+    uint32_t queue_family_count = 1;
+    if (indices.present_family.value != indices.graphics_family.value) {
+        queue_families[queue_family_count++] = indices.present_family.value;
+    }
+    if (
+        app->transfer_family != indices.graphics_family.value and
+        app->transfer_family != indices.present_family.value
+    ) {
+        queue_families[queue_family_count++] = app->transfer_family;
     }
 
     float queue_priority = 1.0f;
-    VkDeviceQueueCreateInfo queue_create_infos[2];
+    VkDeviceQueueCreateInfo queue_create_infos[countof(queue_families)];
     for (uint32_t i = 0; i < queue_family_count; ++i) {
         queue_create_infos[i] = (VkDeviceQueueCreateInfo){
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
@@ -807,8 +1814,21 @@ static int create_logical_device(VulkanApp *app, Arena temp_arena) {
 
     VkPhysicalDeviceFeatures device_features = { 0 };
 
+    VkPhysicalDeviceSynchronization2Features synchronization2_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES,
+        .synchronization2 = VK_TRUE,
+    };
+
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+        .pNext = &synchronization2_features,
+        .timelineSemaphore = VK_TRUE,
+    };
+
     VkPhysicalDeviceScalarBlockLayoutFeatures scalar_layout_features = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SCALAR_BLOCK_LAYOUT_FEATURES,
+        .pNext = &timeline_features,
         .scalarBlockLayout = VK_TRUE,
     };
 
@@ -818,33 +1838,112 @@ static int create_logical_device(VulkanApp *app, Arena temp_arena) {
         .dynamicRendering = VK_TRUE,
     };
 
-    VkDeviceCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .pNext = &dynamic_rendering_features,
-        .queueCreateInfoCount = queue_family_count,
-        .pQueueCreateInfos = queue_create_infos,
-        .pEnabledFeatures = &device_features,
-        .enabledExtensionCount = (uint32_t)countof(DEVICE_EXTENSIONS),
-        .ppEnabledExtensionNames = DEVICE_EXTENSIONS,
-    };
-
-    VkResult result = vkCreateDevice(
-        app->physical_device,
-        &create_info,
-        NULL,
-        &app->device
+    const char **extensions = arena_create_array(
+        const char *,
+        &temp_arena,
+        (
+            countof(DEVICE_EXTENSIONS) +
+            countof(PRESENT_WAIT_DEVICE_EXTENSIONS) +
+            countof(MEMORY_BUDGET_DEVICE_EXTENSIONS)
+        )
     );
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_CREATE_LOGICAL_DEVICE;
+    if (extensions == NULL) {
+        return APP_ERROR_CREATE_LOGICAL_DEVICE_ALLOC;
     }
+    memcpy(extensions, DEVICE_EXTENSIONS, sizeof(DEVICE_EXTENSIONS));
+    uint32_t extension_count = countof(DEVICE_EXTENSIONS);
 
-    volkLoadDevice(app->device);
-
-    vkGetDeviceQueue(
-        app->device,
-        indices.graphics_family.value,
-        0,
-        &app->graphics_queue
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+    };
+    VkPhysicalDevicePresentIdFeaturesKHR present_id_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+        .pNext = &present_wait_features,
+    };
+    {
+        BoolResult result = check_device_extension_support(
+            app->physical_device,
+            PRESENT_WAIT_DEVICE_EXTENSIONS,
+            countof(PRESENT_WAIT_DEVICE_EXTENSIONS),
+            temp_arena
+        );
+        if (result.error != 0) {
+            return result.error;
+        }
+
+        if (result.payload) {
+            VkPhysicalDeviceFeatures2 features = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &present_id_features,
+            };
+            vkGetPhysicalDeviceFeatures2(app->physical_device, &features);
+
+            app->present_wait_supported = present_id_features.presentId and
+                present_wait_features.presentWait;
+        }
+    }
+
+    if (app->present_wait_supported) {
+        memcpy(
+            &extensions[extension_count],
+            PRESENT_WAIT_DEVICE_EXTENSIONS,
+            sizeof(PRESENT_WAIT_DEVICE_EXTENSIONS)
+        );
+        extension_count += countof(PRESENT_WAIT_DEVICE_EXTENSIONS);
+
+        present_wait_features.pNext = dynamic_rendering_features.pNext;
+        dynamic_rendering_features.pNext = &present_id_features;
+    }
+
+    {
+        BoolResult result = check_device_extension_support(
+            app->physical_device,
+            MEMORY_BUDGET_DEVICE_EXTENSIONS,
+            countof(MEMORY_BUDGET_DEVICE_EXTENSIONS),
+            temp_arena
+        );
+        if (result.error != 0) {
+            return result.error;
+        }
+
+        app->memory_budget_supported = result.payload;
+    }
+    if (app->memory_budget_supported) {
+        memcpy(
+            &extensions[extension_count],
+            MEMORY_BUDGET_DEVICE_EXTENSIONS,
+            sizeof(MEMORY_BUDGET_DEVICE_EXTENSIONS)
+        );
+        extension_count += countof(MEMORY_BUDGET_DEVICE_EXTENSIONS);
+    }
+
+    VkDeviceCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = &dynamic_rendering_features,
+        .queueCreateInfoCount = queue_family_count,
+        .pQueueCreateInfos = queue_create_infos,
+        .pEnabledFeatures = &device_features,
+        .enabledExtensionCount = extension_count,
+        .ppEnabledExtensionNames = extensions,
+    };
+
+    VkResult result = vkCreateDevice(
+        app->physical_device,
+        &create_info,
+        app->allocator,
+        &app->device
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_CREATE_LOGICAL_DEVICE;
+    }
+
+    volkLoadDevice(app->device);
+
+    vkGetDeviceQueue(
+        app->device,
+        indices.graphics_family.value,
+        0,
+        &app->graphics_queue
     );
     vkGetDeviceQueue(
         app->device,
@@ -852,6 +1951,12 @@ static int create_logical_device(VulkanApp *app, Arena temp_arena) {
         0,
         &app->present_queue
     );
+    vkGetDeviceQueue(
+        app->device,
+        app->transfer_family,
+        0,
+        &app->transfer_queue
+    );
 
     return 0;
 }
@@ -873,8 +1978,15 @@ static VkSurfaceFormatKHR choose_swap_surface_format(
 }
 
 static VkPresentModeKHR choose_swap_present_mode(
+    VulkanApp *app,
     VkPresentModeKHRSlice available_present_modes
 ) {
+    // FIFO is the only mode that lets the display throttle us, everything
+    // else keeps rendering frames that may never be shown
+    if (app->options.pacing_mode == FRAME_PACING_MIN_POWER) {
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+
     for (size_t i = 0; i < available_present_modes.len; ++i) {
         VkPresentModeKHR present_mode = slice_get(available_present_modes, i);
         if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
@@ -943,6 +2055,7 @@ static int create_swapchain(
         swapchain_support.formats
     );
     VkPresentModeKHR present_mode = choose_swap_present_mode(
+        app,
         swapchain_support.present_modes
     );
     VkExtent2D extent = choose_swap_extent(
@@ -1008,7 +2121,7 @@ static int create_swapchain(
     VkResult result = vkCreateSwapchainKHR(
         app->device,
         &create_info,
-        NULL,
+        app->allocator,
         &app->swapchain
     );
     if (result != VK_SUCCESS) {
@@ -1075,7 +2188,7 @@ static int create_image_views(VulkanApp *app, Arena *swapchain_arena) {
         VkResult result = vkCreateImageView(
             app->device,
             &create_info,
-            NULL,
+            app->allocator,
             &slice_get(app->swapchain_image_views, i)
         );
         if (result != VK_SUCCESS) {
@@ -1148,7 +2261,7 @@ static VkShaderModuleResult create_shader_module(
     VkResult result = vkCreateShaderModule(
         app->device,
         &create_info,
-        NULL,
+        app->allocator,
         &shader_module
     );
     if (result != VK_SUCCESS) {
@@ -1160,23 +2273,226 @@ static VkShaderModuleResult create_shader_module(
     return (VkShaderModuleResult){ .payload = shader_module };
 }
 
+static uint64_t fnv1a_hash(const unsigned char *bytes, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Check a cache file against the device, returning the driver data or an
+// empty slice when the file was written for another device or driver
+static ByteSlice pipeline_cache_file_data(VulkanApp *app, ByteSlice file) {
+    ByteSlice empty = { 0 };
+
+    PipelineCacheFileHeader header;
+    if (file.len < sizeof(header)) {
+        return empty;
+    }
+    memcpy(&header, file.ptr, sizeof(header));
+
+    ByteSlice data = {
+        .ptr = file.ptr + sizeof(header),
+        .len = file.len - sizeof(header),
+    };
+    if (
+        header.magic != PIPELINE_CACHE_MAGIC or
+        header.data_size != data.len or
+        header.data_hash != fnv1a_hash(data.ptr, data.len)
+    ) {
+        return empty;
+    }
+
+    VkPipelineCacheHeaderVersionOne cache_header;
+    if (data.len < sizeof(cache_header)) {
+        return empty;
+    }
+    memcpy(&cache_header, data.ptr, sizeof(cache_header));
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(app->physical_device, &properties);
+    if (
+        header.driver_version != properties.driverVersion or
+        cache_header.headerSize < sizeof(cache_header) or
+        cache_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE or
+        cache_header.vendorID != properties.vendorID or
+        cache_header.deviceID != properties.deviceID or
+        memcmp(
+            cache_header.pipelineCacheUUID,
+            properties.pipelineCacheUUID,
+            VK_UUID_SIZE
+        ) != 0
+    ) {
+        return empty;
+    }
+
+    return data;
+}
+
+// Seed the pipeline cache from the cache file, a missing or stale file
+// just means a cold start
+static int create_pipeline_cache(VulkanApp *app, Arena temp_arena) {
+    ByteSlice data = { 0 };
+    ByteSliceResult result = read_file(
+        PIPELINE_CACHE_FILE,
+        &temp_arena,
+        alignof(PipelineCacheFileHeader)
+    );
+    if (result.error == 0) {
+        data = pipeline_cache_file_data(app, result.payload);
+        if (data.len == 0) {
+            printf("pipeline cache: ignoring stale %s\n", PIPELINE_CACHE_FILE);
+        }
+    }
+
+    VkPipelineCacheCreateInfo cache_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data.len,
+        .pInitialData = data.ptr,
+    };
+    VkResult vk_result = vkCreatePipelineCache(
+        app->device,
+        &cache_info,
+        app->allocator,
+        &app->pipeline_cache.cache
+    );
+    if (vk_result != VK_SUCCESS and data.len != 0) {
+        // the driver may still reject data that passed our checks
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData = NULL;
+        data.len = 0;
+        vk_result = vkCreatePipelineCache(
+            app->device,
+            &cache_info,
+            app->allocator,
+            &app->pipeline_cache.cache
+        );
+    }
+    if (vk_result != VK_SUCCESS) {
+        return APP_ERROR_CREATE_PIPELINE_CACHE;
+    }
+    app->pipeline_cache.loaded_size = data.len;
+
+    return 0;
+}
+
+// Write the cache to a temporary file and move it over the old one, so a
+// crash mid write never leaves a truncated cache behind
+static int save_pipeline_cache(VulkanApp *app, Arena temp_arena) {
+    PipelineCacheState *state = &app->pipeline_cache;
+
+    size_t data_size = 0;
+    VkResult result = vkGetPipelineCacheData(
+        app->device,
+        state->cache,
+        &data_size,
+        NULL
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_SAVE_PIPELINE_CACHE_DATA;
+    }
+    if (state->misses == 0 and data_size == state->loaded_size) {
+        return 0;
+    }
+
+    PipelineCacheFileHeader *header = arena_alloc(
+        &temp_arena,
+        sizeof(*header) + data_size,
+        alignof(PipelineCacheFileHeader)
+    );
+    if (header == NULL) {
+        return APP_ERROR_SAVE_PIPELINE_CACHE_ALLOC;
+    }
+    unsigned char *data = (unsigned char *)(header + 1);
+
+    result = vkGetPipelineCacheData(
+        app->device,
+        state->cache,
+        &data_size,
+        data
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_SAVE_PIPELINE_CACHE_DATA;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(app->physical_device, &properties);
+    *header = (PipelineCacheFileHeader){
+        .magic = PIPELINE_CACHE_MAGIC,
+        .driver_version = properties.driverVersion,
+        .data_size = data_size,
+        .data_hash = fnv1a_hash(data, data_size),
+    };
+
+    FILE *file = fopen(PIPELINE_CACHE_TEMP_FILE, "wb");
+    if (file == NULL) {
+        return APP_ERROR_SAVE_PIPELINE_CACHE_WRITE;
+    }
+    size_t size = sizeof(*header) + data_size;
+    bool written = fwrite(header, 1, size, file) == size and
+        fflush(file) == 0;
+#ifndef _WIN32
+    written = written and fsync(fileno(file)) == 0;
+#endif
+    if (fclose(file) != 0 or !written) {
+        remove(PIPELINE_CACHE_TEMP_FILE);
+        return APP_ERROR_SAVE_PIPELINE_CACHE_WRITE;
+    }
+
+#ifdef _WIN32
+    // rename does not replace an existing file here, losing the cache in
+    // between only costs one cold start
+    remove(PIPELINE_CACHE_FILE);
+#endif
+    if (rename(PIPELINE_CACHE_TEMP_FILE, PIPELINE_CACHE_FILE) != 0) {
+        remove(PIPELINE_CACHE_TEMP_FILE);
+        return APP_ERROR_SAVE_PIPELINE_CACHE_RENAME;
+    }
+
+    return 0;
+}
+
+static void pipeline_cache_report(VulkanApp *app) {
+    PipelineCacheState *state = &app->pipeline_cache;
+    printf(
+        "pipeline cache: %u hits averaging %.3fms, "
+            "%u misses averaging %.3fms\n",
+        state->hits,
+        state->hits == 0 ?
+            0.0 : (double)state->hit_ns / (1e6 * (double)state->hits),
+        state->misses,
+        state->misses == 0 ?
+            0.0 : (double)state->miss_ns / (1e6 * (double)state->misses)
+    );
+}
+
 static int create_descriptor_set_layout(VulkanApp *app) {
-    VkDescriptorSetLayoutBinding ubo_layout_binding = {
-        .binding = 0,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .descriptorCount = 1,
-        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+    VkDescriptorSetLayoutBinding ubo_layout_bindings[] = {
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        },
+        {
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        },
     };
     VkDescriptorSetLayoutCreateInfo layout_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .bindingCount = 1,
-        .pBindings = &ubo_layout_binding,
+        .bindingCount = countof(ubo_layout_bindings),
+        .pBindings = ubo_layout_bindings,
     };
 
     VkResult result = vkCreateDescriptorSetLayout(
         app->device,
         &layout_info,
-        NULL,
+        app->allocator,
         &app->descriptor_set_layout
     );
     if (result != VK_SUCCESS) {
@@ -1363,7 +2679,7 @@ static int create_graphics_pipeline(VulkanApp *app, Arena temp_arena) {
     VkResult result = vkCreatePipelineLayout(
         app->device,
         &pipeline_layout_info,
-        NULL,
+        app->allocator,
         &app->pipeline_layout
     );
     if (result != VK_SUCCESS) {
@@ -1374,8 +2690,16 @@ static int create_graphics_pipeline(VulkanApp *app, Arena temp_arena) {
         app->swapchain_image_format
     };
 
+    // tells whether the pipeline came out of the pipeline cache
+    VkPipelineCreationFeedback creation_feedback = { 0 };
+    VkPipelineCreationFeedbackCreateInfo feedback_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+        .pPipelineCreationFeedback = &creation_feedback,
+    };
+
     VkPipelineRenderingCreateInfo pipeline_rendering_create_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+        .pNext = &feedback_info,
         .colorAttachmentCount = countof(attachment_formats),
         .pColorAttachmentFormats = attachment_formats,
     };
@@ -1400,20 +2724,45 @@ static int create_graphics_pipeline(VulkanApp *app, Arena temp_arena) {
         .basePipelineIndex = -1,
     };
 
+    TimeSpec start;
+    int clock_error = timespec_now(&start);
+
     result = vkCreateGraphicsPipelines(
         app->device,
-        VK_NULL_HANDLE,
+        app->pipeline_cache.cache,
         1,
         &pipeline_info,
-        NULL,
+        app->allocator,
         &app->graphics_pipeline
     );
     if (result != VK_SUCCESS) {
         return APP_ERROR_CREATE_GRAPHICS_PIPELINE_CREATE;
     }
 
-    vkDestroyShaderModule(app->device, frag_shader_module, NULL);
-    vkDestroyShaderModule(app->device, vert_shader_module, NULL);
+    TimeSpec end;
+    clock_error = clock_error != 0 ? clock_error : timespec_now(&end);
+    int64_t elapsed = clock_error == 0 ? timespec_diff(&end, &start) : 0;
+
+    // without valid feedback the driver may not use the cache at all
+    VkPipelineCreationFeedbackFlags hit_flags =
+        VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT |
+        VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT;
+    bool hit = (creation_feedback.flags & hit_flags) == hit_flags;
+    if (hit) {
+        app->pipeline_cache.hits += 1;
+        app->pipeline_cache.hit_ns += elapsed;
+    } else {
+        app->pipeline_cache.misses += 1;
+        app->pipeline_cache.miss_ns += elapsed;
+    }
+    printf(
+        "pipeline: created in %.3fms (cache %s)\n",
+        (double)elapsed / 1e6,
+        hit ? "hit" : "miss"
+    );
+
+    vkDestroyShaderModule(app->device, frag_shader_module, app->allocator);
+    vkDestroyShaderModule(app->device, vert_shader_module, app->allocator);
 
     return 0;
 }
@@ -1441,786 +2790,2574 @@ static int create_command_pool(VulkanApp *app, Arena temp_arena) {
     VkResult result = vkCreateCommandPool(
         app->device,
         &pool_info,
-        NULL,
+        app->allocator,
         &app->command_pool
     );
     if (result != VK_SUCCESS) {
         return APP_ERROR_CREATE_COMMAND_POOL;
     }
 
+    // recording threads reset their pools wholesale every frame instead of
+    // resetting individual command buffers
+    VkCommandPoolCreateInfo record_pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queue_family_indices.graphics_family.value,
+    };
+    for (size_t i = 0; i < app->frames.len; ++i) {
+        FrameData *frame = &slice_get(app->frames, i);
+        for (uint32_t j = 0; j < app->options.record_threads; ++j) {
+            result = vkCreateCommandPool(
+                app->device,
+                &record_pool_info,
+                app->allocator,
+                &frame->record_command_pools[j]
+            );
+            if (result != VK_SUCCESS) {
+                return APP_ERROR_CREATE_COMMAND_POOL;
+            }
+        }
+    }
+
     return 0;
 }
 
 typedef Result(uint32_t) MemoryTypeIndexResult;
 
+static int count_bits(uint32_t bits) {
+    int count = 0;
+    for (; bits != 0; bits &= bits - 1) {
+        count += 1;
+    }
+    return count;
+}
+
+// Pick the memory type with all required properties that has the most
+// preferred and the fewest avoided ones, ties go to the driver's order
 static MemoryTypeIndexResult find_memory_type(
     VulkanApp *app,
     uint32_t type_filter,
-    VkMemoryPropertyFlags properties
+    MemoryUsage usage
 ) {
-    VkPhysicalDeviceMemoryProperties mem_properties;
-    vkGetPhysicalDeviceMemoryProperties(
-        app->physical_device,
-        &mem_properties
-    );
+    VkPhysicalDeviceMemoryProperties *mem_properties =
+        &app->device_memory.memory_properties;
+    const MemoryUsageInfo *info = &MEMORY_USAGE_INFOS[usage];
 
-    for (uint32_t i = 0; i < mem_properties.memoryTypeCount; ++i) {
+    MemoryTypeIndexResult best = { .error = APP_ERROR_FIND_MEMORY_TYPE };
+    int best_score = 0;
+    for (uint32_t i = 0; i < mem_properties->memoryTypeCount; ++i) {
         if (!(type_filter & (1U << i))) {
             continue;
         }
 
         VkMemoryPropertyFlags type_properties =
-            mem_properties.memoryTypes[i].propertyFlags;
-        if ((type_properties & properties) == properties) {
-            return (MemoryTypeIndexResult){ .payload = i };
+            mem_properties->memoryTypes[i].propertyFlags;
+        if ((type_properties & info->required) != info->required) {
+            continue;
+        }
+
+        int score = 2 * count_bits(type_properties & info->preferred) -
+            count_bits(type_properties & info->avoided);
+        if (best.error != 0 or score > best_score) {
+            best = (MemoryTypeIndexResult){ .payload = i };
+            best_score = score;
         }
     }
 
-    return (MemoryTypeIndexResult){ .error = APP_ERROR_FIND_MEMORY_TYPE };
+    return best;
 }
 
-static int create_color_resources(VulkanApp *app) {
-    VkImageCreateInfo image_info = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .imageType = VK_IMAGE_TYPE_2D,
-        .extent.width = app->swapchain_extent.width,
-        .extent.height = app->swapchain_extent.height,
-        .extent.depth = 1,
-        .mipLevels = 1,
-        .arrayLayers = 1,
-        .format = app->swapchain_image_format,
-        .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT |
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-        .samples = app->msaa_samples,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
+static void device_memory_init(VulkanApp *app) {
+    DeviceMemoryAllocator *allocator = &app->device_memory;
 
-    VkResult result = vkCreateImage(
-        app->device,
-        &image_info,
-        NULL,
-        &app->color_image
+    vkGetPhysicalDeviceMemoryProperties(
+        app->physical_device,
+        &allocator->memory_properties
     );
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_CREATE_COLOR_RESOURCES_CREATE;
-    }
 
-    VkMemoryRequirements mem_requirements;
-    vkGetImageMemoryRequirements(
-        app->device,
-        app->color_image,
-        &mem_requirements
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(app->physical_device, &properties);
+    allocator->granularity = max(
+        properties.limits.bufferImageGranularity,
+        (VkDeviceSize)1
     );
 
-    uint32_t memory_type_index;
-    {
-        MemoryTypeIndexResult memory_type_index_result = find_memory_type(
-            app,
-            mem_requirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-        );
-        if (memory_type_index_result.error != 0) {
-            return memory_type_index_result.error;
+    VkMemoryPropertyFlags direct_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkPhysicalDeviceMemoryProperties *mem_properties =
+        &allocator->memory_properties;
+    allocator->direct_write = false;
+    for (uint32_t i = 0; i < mem_properties->memoryTypeCount; ++i) {
+        VkMemoryType *memory_type = &mem_properties->memoryTypes[i];
+        VkDeviceSize heap_size =
+            mem_properties->memoryHeaps[memory_type->heapIndex].size;
+        if (
+            (memory_type->propertyFlags & direct_flags) == direct_flags and
+            heap_size > DIRECT_WRITE_MIN_HEAP_SIZE
+        ) {
+            allocator->direct_write = true;
         }
-
-        memory_type_index = memory_type_index_result.payload;
-    }
-
-    VkMemoryAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = mem_requirements.size,
-        .memoryTypeIndex = memory_type_index,
-    };
-
-    result = vkAllocateMemory(
-        app->device,
-        &alloc_info,
-        NULL,
-        &app->color_image_memory
-    );
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_CREATE_COLOR_RESOURCES_ALLOC;
     }
+}
 
-    vkBindImageMemory(
-        app->device,
-        app->color_image,
-        app->color_image_memory,
-        0
-    );
-
-    VkImageViewCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image = app->color_image,
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = app->swapchain_image_format,
-        .subresourceRange = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1,
-        },
-    };
+static uint32_t memory_type_heap(VulkanApp *app, uint32_t memory_type_index) {
+    return app->device_memory.memory_properties
+        .memoryTypes[memory_type_index].heapIndex;
+}
 
-    result = vkCreateImageView(
-        app->device,
-        &create_info,
-        NULL,
-        &app->color_image_view
-    );
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_CREATE_IMAGE_VIEWS_CREATE;
-    }
+static VkDeviceSize align_device_size(VkDeviceSize size, VkDeviceSize align) {
+    return (size + align - 1) & ~(align - 1);
+}
 
-    return 0;
+static bool memory_ranges_share_page(
+    VkDeviceSize last_byte,
+    VkDeviceSize first_byte,
+    VkDeviceSize granularity
+) {
+    return (last_byte & ~(granularity - 1)) ==
+        (first_byte & ~(granularity - 1));
 }
 
-static int create_buffer(
-    VulkanApp *app,
-    VkDeviceSize size,
-    VkBufferUsageFlags usage,
-    VkMemoryPropertyFlags properties,
-    VkBuffer *buffer,
-    VkDeviceMemory *buffer_memory
+// First fit over the free ranges of `block`, splitting off the unused head
+// and tail of the chosen range. Returns false if nothing fits
+static bool memory_block_alloc(
+    DeviceMemoryBlock *block,
+    VkDeviceSize granularity,
+    VkMemoryRequirements *requirements,
+    MemoryRangeKind kind,
+    VkDeviceSize *offset
 ) {
-    VkBufferCreateInfo buffer_info = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
+    for (uint32_t i = 0; i < block->range_count; ++i) {
+        MemoryRange *range = &block->ranges[i];
+        if (
+            range->kind != MEMORY_RANGE_FREE or
+            range->size < requirements->size
+        ) {
+            continue;
+        }
 
-    VkResult result = vkCreateBuffer(
-        app->device,
-        &buffer_info,
-        NULL,
-        buffer
-    );
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_CREATE_BUFFER_CREATE;
-    }
+        VkDeviceSize start = align_device_size(
+            range->offset,
+            requirements->alignment
+        );
+        if (i > 0) {
+            MemoryRange *prev = &block->ranges[i - 1];
+            if (
+                prev->kind != kind and
+                memory_ranges_share_page(
+                    prev->offset + prev->size - 1,
+                    start,
+                    granularity
+                )
+            ) {
+                start = align_device_size(start, granularity);
+            }
+        }
 
-    VkMemoryRequirements mem_requirements;
-    vkGetBufferMemoryRequirements(
-        app->device,
-        *buffer,
-        &mem_requirements
-    );
+        VkDeviceSize end = start + requirements->size;
+        VkDeviceSize range_end = range->offset + range->size;
+        if (end > range_end) {
+            continue;
+        }
+        if (i + 1 < block->range_count) {
+            MemoryRange *next = &block->ranges[i + 1];
+            if (
+                next->kind != kind and
+                memory_ranges_share_page(end - 1, next->offset, granularity)
+            ) {
+                continue;
+            }
+        }
 
-    uint32_t memory_type_index;
-    {
-        MemoryTypeIndexResult memory_type_index_result = find_memory_type(
-            app,
-            mem_requirements.memoryTypeBits,
-            properties
-        );
-        if (memory_type_index_result.error != 0) {
-            return memory_type_index_result.error;
+        uint32_t split_count = 0;
+        if (start > range->offset) {
+            split_count += 1;
+        }
+        if (end < range_end) {
+            split_count += 1;
+        }
+        if (block->range_count + split_count > MAX_DEVICE_MEMORY_RANGES) {
+            return false;
         }
 
-        memory_type_index = memory_type_index_result.payload;
-    }
+        MemoryRange used = {
+            .offset = start,
+            .size = requirements->size,
+            .kind = kind,
+        };
+        MemoryRange head = {
+            .offset = range->offset,
+            .size = start - range->offset,
+        };
+        MemoryRange tail = { .offset = end, .size = range_end - end };
 
-    VkMemoryAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = mem_requirements.size,
-        .memoryTypeIndex = memory_type_index,
-    };
+        memmove(
+            &block->ranges[i + 1 + split_count],
+            &block->ranges[i + 1],
+            sizeof(*block->ranges) * (block->range_count - i - 1)
+        );
+        block->range_count += split_count;
 
-    result = vkAllocateMemory(
-        app->device,
-        &alloc_info,
-        NULL,
-        buffer_memory
-    );
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_CREATE_BUFFER_MEMORY;
-    }
+        if (head.size > 0) {
+            block->ranges[i++] = head;
+        }
+        block->ranges[i++] = used;
+        if (tail.size > 0) {
+            block->ranges[i] = tail;
+        }
 
-    vkBindBufferMemory(
-        app->device,
-        *buffer,
-        *buffer_memory,
-        0
-    );
+        *offset = start;
+        return true;
+    }
 
-    return 0;
+    return false;
 }
 
-static int copy_buffer(
+static int device_memory_create_block(
     VulkanApp *app,
-    VkBuffer dst_buffer,
-    VkBuffer src_buffer,
-    VkDeviceSize size
+    uint32_t memory_type_index,
+    VkDeviceSize min_size
 ) {
-    VkCommandBufferAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandPool = app->command_pool,
-        .commandBufferCount = 1,
-    };
+    DeviceMemoryAllocator *allocator = &app->device_memory;
 
-    VkCommandBuffer command_buffer; 
-    VkResult result = vkAllocateCommandBuffers(
-        app->device,
-        &alloc_info,
-        &command_buffer
+    // reuse the slot of a released dedicated block
+    uint32_t block_index = 0;
+    while (
+        block_index < allocator->block_count and
+        allocator->blocks[block_index].memory != VK_NULL_HANDLE
+    ) {
+        block_index += 1;
+    }
+    if (block_index == MAX_DEVICE_MEMORY_BLOCKS) {
+        return APP_ERROR_DEVICE_MEMORY_BLOCKS;
+    }
+
+    // keep blocks small relative to their heap, requests larger than a
+    // block get a block of their own
+    VkMemoryType *memory_type =
+        &allocator->memory_properties.memoryTypes[memory_type_index];
+    VkDeviceSize heap_size =
+        allocator->memory_properties.memoryHeaps[memory_type->heapIndex].size;
+    VkDeviceSize block_size = min(
+        (VkDeviceSize)DEVICE_MEMORY_BLOCK_SIZE,
+        heap_size / 8
     );
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_COPY_BUFFER_ALLOCATE;
+    bool dedicated = min_size > block_size;
+
+    // lazily allocated memory is committed per allocation, so sharing a
+    // block would only make the commitment harder to track
+    if (
+        memory_type->propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT
+    ) {
+        dedicated = true;
+    }
+    if (dedicated) {
+        block_size = min_size;
     }
 
-    VkCommandBufferBeginInfo begin_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    DeviceMemoryBlock *block = &allocator->blocks[block_index];
+    *block = (DeviceMemoryBlock){
+        .memory_type_index = memory_type_index,
+        .size = block_size,
+        .dedicated = dedicated,
+        .ranges = { { .offset = 0, .size = block_size } },
+        .range_count = 1,
     };
-    vkBeginCommandBuffer(command_buffer, &begin_info);
 
-    VkBufferCopy copy_region = {
-        .srcOffset = 0,
-        .dstOffset = 0,
-        .size = size
+    VkMemoryAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = block_size,
+        .memoryTypeIndex = memory_type_index,
     };
-    vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
-
-    result = vkEndCommandBuffer(command_buffer);
+    VkResult result = vkAllocateMemory(
+        app->device,
+        &alloc_info,
+        app->allocator,
+        &block->memory
+    );
     if (result != VK_SUCCESS) {
-        return APP_ERROR_COPY_BUFFER_COMMAND;
+        block->memory = VK_NULL_HANDLE;
+        return APP_ERROR_DEVICE_MEMORY_ALLOC;
     }
 
-    VkSubmitInfo submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &command_buffer,
-    };
-    result = vkQueueSubmit(
-        app->graphics_queue,
-        1,
-        &submit_info,
-        VK_NULL_HANDLE
-    );
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_COPY_BUFFER_SUBMIT;
+    if (memory_type->propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(
+            app->device,
+            block->memory,
+            0,
+            VK_WHOLE_SIZE,
+            0,
+            (void **)&block->mapped
+        );
+        if (result != VK_SUCCESS) {
+            vkFreeMemory(app->device, block->memory, app->allocator);
+            block->memory = VK_NULL_HANDLE;
+            return APP_ERROR_DEVICE_MEMORY_MAP;
+        }
     }
 
-    vkQueueWaitIdle(app->graphics_queue);
+    allocator->block_count = max(allocator->block_count, block_index + 1);
 
-    vkFreeCommandBuffers(app->device, app->command_pool, 1, &command_buffer);
+    uint32_t heap = memory_type->heapIndex;
+    allocator->heap_reserved[heap] += block_size;
+    allocator->heap_reserved_peak[heap] = max(
+        allocator->heap_reserved_peak[heap],
+        allocator->heap_reserved[heap]
+    );
 
     return 0;
 }
 
-static int create_vertex_buffer(VulkanApp *app) {
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_buffer_memory;
-
-    int error = create_buffer(
-        app,
-        sizeof(VERTICES),
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &staging_buffer,
-        &staging_buffer_memory
-    );
-    if (error != 0) {
-        return 0;
-    }
+static int device_memory_alloc(
+    VulkanApp *app,
+    VkMemoryRequirements *requirements,
+    MemoryUsage usage,
+    MemoryRangeKind kind,
+    MemoryCategory category,
+    DeviceAllocation *allocation
+) {
+    DeviceMemoryAllocator *allocator = &app->device_memory;
 
+    uint32_t memory_type_index;
     {
-        void *buffer;
-        vkMapMemory(
-            app->device,
-            staging_buffer_memory,
-            0,
-            sizeof(VERTICES),
-            0,
-            &buffer
+        MemoryTypeIndexResult memory_type_index_result = find_memory_type(
+            app,
+            requirements->memoryTypeBits,
+            usage
         );
-        memcpy(buffer, VERTICES, (size_t)sizeof(VERTICES));
-        vkUnmapMemory(app->device, staging_buffer_memory);
+        if (memory_type_index_result.error != 0) {
+            return memory_type_index_result.error;
+        }
+
+        memory_type_index = memory_type_index_result.payload;
     }
 
-    create_buffer(
-        app,
-        sizeof(VERTICES),
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        &app->vertex_buffer,
-        &app->vertex_buffer_memory
-    );
+    for (uint32_t attempt = 0; attempt < 2; ++attempt) {
+        for (uint32_t i = 0; i < allocator->block_count; ++i) {
+            DeviceMemoryBlock *block = &allocator->blocks[i];
+            if (
+                block->memory == VK_NULL_HANDLE or
+                block->memory_type_index != memory_type_index
+            ) {
+                continue;
+            }
 
-    error = copy_buffer(
-        app,
-        app->vertex_buffer,
-        staging_buffer,
-        sizeof(VERTICES)
-    );
-    if (error != 0) {
-        return error;
-    }
+            VkDeviceSize offset;
+            bool found = memory_block_alloc(
+                block,
+                allocator->granularity,
+                requirements,
+                kind,
+                &offset
+            );
+            if (found) {
+                *allocation = (DeviceAllocation){
+                    .memory = block->memory,
+                    .block_index = i,
+                    .offset = offset,
+                    .size = requirements->size,
+                    .category = category,
+                };
+                if (block->mapped != NULL) {
+                    allocation->mapped = block->mapped + offset;
+                }
+
+                allocator->category_usage[category] += requirements->size;
+                allocator->category_peak[category] = max(
+                    allocator->category_peak[category],
+                    allocator->category_usage[category]
+                );
+                allocator->heap_allocated[
+                    memory_type_heap(app, memory_type_index)
+                ] += requirements->size;
+                return 0;
+            }
+        }
 
-    vkDestroyBuffer(app->device, staging_buffer, NULL);
-    vkFreeMemory(app->device, staging_buffer_memory, NULL);
+        if (attempt == 0) {
+            int error = device_memory_create_block(
+                app,
+                memory_type_index,
+                requirements->size
+            );
+            if (error != 0) {
+                return error;
+            }
+        }
+    }
 
-    return 0;
+    return APP_ERROR_DEVICE_MEMORY_ALLOC;
 }
 
-static int create_index_buffer(VulkanApp *app) {
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_buffer_memory;
-
-    int error = create_buffer(
-        app,
-        sizeof(INDICES),
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &staging_buffer,
-        &staging_buffer_memory
-    );
-    if (error != 0) {
-        return error;
+static void device_memory_free(VulkanApp *app, DeviceAllocation *allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
     }
 
-    {
-        void *data;
-        vkMapMemory(
-            app->device,
-            staging_buffer_memory,
-            0,
-            sizeof(INDICES),
-            0,
-            &data
-        );
-        memcpy(data, INDICES, sizeof(INDICES));
-        vkUnmapMemory(app->device, staging_buffer_memory);
+    DeviceMemoryAllocator *allocator = &app->device_memory;
+    DeviceMemoryBlock *block = &allocator->blocks[allocation->block_index];
+    uint32_t heap = memory_type_heap(app, block->memory_type_index);
+    allocator->category_usage[allocation->category] -= allocation->size;
+    allocator->heap_allocated[heap] -= allocation->size;
+
+    uint32_t low = 0;
+    uint32_t high = block->range_count;
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        if (block->ranges[mid].offset <= allocation->offset) {
+            low = mid;
+        } else {
+            high = mid;
+        }
     }
-
-    error = create_buffer(
-        app,
-        sizeof(INDICES),
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-            VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        &app->index_buffer,
-        &app->index_buffer_memory
-    );
-    if (error != 0) {
-        return error;
+    uint32_t i = low;
+    assert(block->ranges[i].offset == allocation->offset);
+    block->ranges[i].kind = MEMORY_RANGE_FREE;
+
+    uint32_t first = i;
+    uint32_t last = i;
+    if (i > 0 and block->ranges[i - 1].kind == MEMORY_RANGE_FREE) {
+        first = i - 1;
+    }
+    if (
+        i + 1 < block->range_count and
+        block->ranges[i + 1].kind == MEMORY_RANGE_FREE
+    ) {
+        last = i + 1;
+    }
+    if (last > first) {
+        MemoryRange *merged = &block->ranges[first];
+        merged->size = block->ranges[last].offset + block->ranges[last].size -
+            merged->offset;
+        memmove(
+            &block->ranges[first + 1],
+            &block->ranges[last + 1],
+            sizeof(*block->ranges) * (block->range_count - last - 1)
+        );
+        block->range_count -= last - first;
     }
 
-    error = copy_buffer(
-        app,
-        app->index_buffer,
-        staging_buffer,
-        sizeof(INDICES)
-    );
-    if (error != 0) {
-        return error;
+    if (block->dedicated) {
+        assert(block->range_count == 1);
+        vkFreeMemory(app->device, block->memory, app->allocator);
+        block->memory = VK_NULL_HANDLE;
+        allocator->heap_reserved[heap] -= block->size;
     }
 
-    vkDestroyBuffer(app->device, staging_buffer, NULL);
-    vkFreeMemory(app->device, staging_buffer_memory, NULL);
+    *allocation = (DeviceAllocation){ 0 };
+}
 
-    return 0;
+static void device_memory_cleanup(VulkanApp *app) {
+    DeviceMemoryAllocator *allocator = &app->device_memory;
+    for (uint32_t i = 0; i < allocator->block_count; ++i) {
+        if (allocator->blocks[i].memory != VK_NULL_HANDLE) {
+            vkFreeMemory(
+                app->device,
+                allocator->blocks[i].memory,
+                app->allocator
+            );
+        }
+    }
+    allocator->block_count = 0;
 }
 
-static int create_command_buffers(VulkanApp *app) {
-    VkCommandBufferAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = app->command_pool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = countof(app->command_buffers),
-    };
+// Current usage and budget of every heap, the block bytes held in it now
+// and at most, along with the memory held by each category of resources
+static void device_memory_stats(VulkanApp *app, MemoryStats *stats) {
+    DeviceMemoryAllocator *allocator = &app->device_memory;
 
-    VkResult result = vkAllocateCommandBuffers(
-        app->device,
-        &alloc_info,
-        app->command_buffers
-    );
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_CREATE_COMMAND_BUFFER;
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_properties = {
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+    };
+    if (app->memory_budget_supported) {
+        VkPhysicalDeviceMemoryProperties2 properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+            .pNext = &budget_properties,
+        };
+        vkGetPhysicalDeviceMemoryProperties2(
+            app->physical_device,
+            &properties
+        );
     }
 
-    return 0;
+    *stats = (MemoryStats){
+        .heap_count = allocator->memory_properties.memoryHeapCount,
+    };
+    for (uint32_t i = 0; i < stats->heap_count; ++i) {
+        MemoryHeapStats *heap = &stats->heaps[i];
+        heap->reserved = allocator->heap_reserved[i];
+        heap->allocated = allocator->heap_allocated[i];
+        if (app->memory_budget_supported) {
+            heap->usage = budget_properties.heapUsage[i];
+            heap->budget = budget_properties.heapBudget[i];
+        } else {
+            heap->usage = heap->reserved;
+            heap->budget = allocator->memory_properties.memoryHeaps[i].size /
+                100 * MEMORY_BUDGET_FALLBACK_PERCENT;
+        }
+        heap->reserved_peak = allocator->heap_reserved_peak[i];
+    }
+    for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+        stats->category_usage[i] = allocator->category_usage[i];
+        stats->category_peak[i] = allocator->category_peak[i];
+    }
 }
 
-static int create_sync_objects(VulkanApp *app) {
-    VkSemaphoreCreateInfo semaphore_info = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-    };
+static void device_memory_report(VulkanApp *app) {
+    TimeSpec now;
+    if (timespec_now(&now) != 0) {
+        return;
+    }
+    if (app->memory_report_start.tv_sec == 0) {
+        app->memory_report_start = now;
+        return;
+    }
+    if (timespec_diff(&now, &app->memory_report_start) < MEMORY_REPORT_NS) {
+        return;
+    }
+    app->memory_report_start = now;
 
-    VkFenceCreateInfo fence_info = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
-    };
+    MemoryStats stats;
+    device_memory_stats(app, &stats);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-        VkResult result = vkCreateSemaphore(
-            app->device,
-            &semaphore_info,
-            NULL,
-            &app->image_available_semaphores[i]
-        );
-        if (result != VK_SUCCESS) {
-            return APP_ERROR_CREATE_SYNC_OBJECTS_AVAILABLE;
+    double mib = 1024.0 * 1024.0;
+    printf("memory%s:", app->memory_budget_supported ? "" : " (estimated)");
+    for (uint32_t i = 0; i < stats.heap_count; ++i) {
+        MemoryHeapStats *heap = &stats.heaps[i];
+        if (heap->reserved == 0) {
+            continue;
         }
-        
-        result = vkCreateSemaphore(
-            app->device,
-            &semaphore_info,
-            NULL,
-            &app->render_finished_semaphores[i]
+        printf(
+            " heap %u %.1f/%.1f MiB (blocks %.1f MiB, peak %.1f MiB),",
+            i,
+            (double)heap->usage / mib,
+            (double)heap->budget / mib,
+            (double)heap->reserved / mib,
+            (double)heap->reserved_peak / mib
         );
-        if (result != VK_SUCCESS) {
-            return APP_ERROR_CREATE_SYNC_OBJECTS_FINISHED;
-        }
-
-        result = vkCreateFence(
-            app->device,
-            &fence_info,
-            NULL,
-            &app->in_flight_fences[i]
+    }
+    for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+        printf(
+            " %s %.2f MiB%s",
+            MEMORY_CATEGORY_NAMES[i],
+            (double)stats.category_usage[i] / mib,
+            i + 1 < MEMORY_CATEGORY_COUNT ? "," : "\n"
         );
-        if (result != VK_SUCCESS) {
-            return APP_ERROR_CREATE_SYNC_OBJECTS_FENCE;
-        }
     }
+}
 
-    return 0;
+static uint32_t attachment_size_class(uint32_t size) {
+    return (size + ATTACHMENT_SIZE_CLASS - 1) / ATTACHMENT_SIZE_CLASS *
+        ATTACHMENT_SIZE_CLASS;
 }
 
-static int create_uniform_buffers(VulkanApp *app) {
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-        int error = create_buffer(
-            app,
-            sizeof(UniformBufferObject),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            &app->uniform_buffers[i],
-            &app->uniform_buffers_memory[i]
-        );
-        if (error != 0) {
-            return error;
-        }
+// Whether a pooled attachment covers the swapchain extent without wasting
+// too much memory
+static bool attachment_pool_fits(VulkanApp *app, PooledAttachment *entry) {
+    VkExtent2D extent = app->swapchain_extent;
+    uint64_t max_area = (uint64_t)ATTACHMENT_MAX_WASTE *
+        attachment_size_class(extent.width) *
+        attachment_size_class(extent.height);
+    uint64_t area = (uint64_t)entry->extent.width * entry->extent.height;
+
+    return entry->format == app->swapchain_image_format and
+        entry->extent.width >= extent.width and
+        entry->extent.height >= extent.height and
+        area <= max_area;
+}
 
-        vkMapMemory(
-            app->device,
-            app->uniform_buffers_memory[i],
-            0,
-            sizeof(UniformBufferObject),
-            0,
-            &app->uniform_buffers_mapped[i]
+// The smallest pooled attachment that fits the swapchain, or -1 if there is
+// none
+static int attachment_pool_find(
+    VulkanApp *app,
+    VkSampleCountFlagBits samples
+) {
+    AttachmentPool *pool = &app->attachments;
+
+    int best = -1;
+    uint64_t best_area = 0;
+    for (uint32_t i = 0; i < pool->count; ++i) {
+        PooledAttachment *entry = &pool->entries[i];
+        uint64_t area = (uint64_t)entry->extent.width * entry->extent.height;
+        if (entry->samples != samples or !attachment_pool_fits(app, entry)) {
+            continue;
+        }
+        if (best < 0 or area < best_area) {
+            best = (int)i;
+            best_area = area;
+        }
+    }
+
+    return best;
+}
+
+// Must only be called while the GPU is idle
+static void attachment_pool_remove(VulkanApp *app, uint32_t index) {
+    AttachmentPool *pool = &app->attachments;
+    PooledAttachment *entry = &pool->entries[index];
+    vkDestroyImageView(app->device, entry->view, app->allocator);
+    vkDestroyImage(app->device, entry->image, app->allocator);
+    device_memory_free(app, &entry->allocation);
+
+    pool->count -= 1;
+    *entry = pool->entries[pool->count];
+}
+
+static void attachment_pool_cleanup(VulkanApp *app) {
+    while (app->attachments.count > 0) {
+        attachment_pool_remove(app, 0);
+    }
+}
+
+// Destroy the pooled attachments that don't fit the swapchain at any sample
+// count. Must only be called while the GPU is idle
+static void attachment_pool_evict(VulkanApp *app) {
+    AttachmentPool *pool = &app->attachments;
+    for (uint32_t i = 0; i < pool->count;) {
+        if (attachment_pool_fits(app, &pool->entries[i])) {
+            i += 1;
+        } else {
+            attachment_pool_remove(app, i);
+        }
+    }
+}
+
+static VkImageCreateInfo color_image_info(
+    VulkanApp *app,
+    VkSampleCountFlagBits samples
+) {
+    return (VkImageCreateInfo){
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent.width = attachment_size_class(app->swapchain_extent.width),
+        .extent.height = attachment_size_class(app->swapchain_extent.height),
+        .extent.depth = 1,
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .format = app->swapchain_image_format,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .samples = samples,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+}
+
+// Pick the highest sample count whose color attachment keeps its heap within
+// MEMORY_BUDGET_PERCENT of the budget. Pooled attachments that can't back
+// the swapchain are destroyed first so their memory isn't counted. Must be
+// called while the GPU is idle, returns true if the sample count changed
+static bool choose_msaa_samples(VulkanApp *app) {
+    attachment_pool_evict(app);
+
+    MemoryStats stats;
+    device_memory_stats(app, &stats);
+
+    VkSampleCountFlagBits samples = app->max_msaa_samples;
+    for (; samples != VK_SAMPLE_COUNT_1_BIT; samples >>= 1) {
+        // a pooled attachment needs no new memory
+        if (attachment_pool_find(app, samples) >= 0) {
+            break;
+        }
+
+        VkImageCreateInfo image_info = color_image_info(app, samples);
+        VkDeviceImageMemoryRequirements info = {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+            .pCreateInfo = &image_info,
+        };
+        VkMemoryRequirements2 requirements = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+        };
+        vkGetDeviceImageMemoryRequirements(app->device, &info, &requirements);
+
+        MemoryTypeIndexResult memory_type_index_result = find_memory_type(
+            app,
+            requirements.memoryRequirements.memoryTypeBits,
+            MEMORY_USAGE_TRANSIENT
         );
+        if (memory_type_index_result.error != 0) {
+            continue;
+        }
+
+        // free space in existing blocks can be reused without growing
+        MemoryHeapStats *heap = &stats.heaps[
+            memory_type_heap(app, memory_type_index_result.payload)
+        ];
+        VkDeviceSize reusable = heap->reserved - heap->allocated;
+        VkDeviceSize used = heap->usage - min(heap->usage, reusable);
+        VkDeviceSize limit = heap->budget / 100 * MEMORY_BUDGET_PERCENT;
+        if (used + requirements.memoryRequirements.size <= limit) {
+            break;
+        }
     }
 
-    return 0;
+    if (samples == app->msaa_samples) {
+        return false;
+    }
+
+    printf(
+        "memory: %s msaa from %ux to %ux for the memory budget\n",
+        samples < app->msaa_samples ? "lowering" : "raising",
+        (unsigned)app->msaa_samples,
+        (unsigned)samples
+    );
+    app->msaa_samples = samples;
+    return true;
 }
 
-static int create_descriptor_pool(VulkanApp *app) {
-    VkDescriptorPoolSize pool_size = {
-        .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .descriptorCount = MAX_FRAMES_IN_FLIGHT,
+static int create_color_resources(VulkanApp *app) {
+    AttachmentPool *pool = &app->attachments;
+    pool->uses += 1;
+
+    int found = attachment_pool_find(app, app->msaa_samples);
+    if (found >= 0) {
+        pool->current = (uint32_t)found;
+        pool->entries[found].last_used = pool->uses;
+        app->color_image = pool->entries[found].image;
+        app->color_image_view = pool->entries[found].view;
+        return 0;
+    }
+
+    // attachments with another sample count or format are left over from
+    // a budget change or a new surface format and won't be used again
+    for (uint32_t i = 0; i < pool->count;) {
+        PooledAttachment *entry = &pool->entries[i];
+        if (
+            entry->samples != app->msaa_samples or
+            entry->format != app->swapchain_image_format
+        ) {
+            attachment_pool_remove(app, i);
+        } else {
+            i += 1;
+        }
+    }
+    if (pool->count == MAX_POOLED_ATTACHMENTS) {
+        uint32_t oldest = 0;
+        for (uint32_t i = 1; i < pool->count; ++i) {
+            if (pool->entries[i].last_used < pool->entries[oldest].last_used) {
+                oldest = i;
+            }
+        }
+        attachment_pool_remove(app, oldest);
+    }
+
+    VkImageCreateInfo image_info = color_image_info(app, app->msaa_samples);
+    PooledAttachment *entry = &pool->entries[pool->count];
+    *entry = (PooledAttachment){
+        .format = image_info.format,
+        .extent = {
+            .width = image_info.extent.width,
+            .height = image_info.extent.height,
+        },
+        .samples = app->msaa_samples,
+        .last_used = pool->uses,
     };
-    VkDescriptorPoolCreateInfo pool_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .poolSizeCount = 1,
-        .pPoolSizes = &pool_size,
-        .maxSets = MAX_FRAMES_IN_FLIGHT,
+
+    VkResult result = vkCreateImage(
+        app->device,
+        &image_info,
+        app->allocator,
+        &entry->image
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_CREATE_COLOR_RESOURCES_CREATE;
+    }
+
+    VkMemoryRequirements mem_requirements;
+    vkGetImageMemoryRequirements(
+        app->device,
+        entry->image,
+        &mem_requirements
+    );
+
+    int error = device_memory_alloc(
+        app,
+        &mem_requirements,
+        MEMORY_USAGE_TRANSIENT,
+        MEMORY_RANGE_OPTIMAL,
+        MEMORY_CATEGORY_ATTACHMENT,
+        &entry->allocation
+    );
+    if (error != 0) {
+        vkDestroyImage(app->device, entry->image, app->allocator);
+        return error;
+    }
+
+    result = vkBindImageMemory(
+        app->device,
+        entry->image,
+        entry->allocation.memory,
+        entry->allocation.offset
+    );
+    if (result != VK_SUCCESS) {
+        vkDestroyImage(app->device, entry->image, app->allocator);
+        device_memory_free(app, &entry->allocation);
+        return APP_ERROR_DEVICE_MEMORY_BIND;
+    }
+
+    VkImageViewCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = entry->image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = app->swapchain_image_format,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
     };
 
-    VkResult result = vkCreateDescriptorPool(
+    result = vkCreateImageView(
         app->device,
-        &pool_info,
-        NULL,
-        &app->descriptor_pool
+        &create_info,
+        app->allocator,
+        &entry->view
     );
     if (result != VK_SUCCESS) {
-        return APP_ERROR_CREATE_DESCRIPTOR_POOL;
+        vkDestroyImage(app->device, entry->image, app->allocator);
+        device_memory_free(app, &entry->allocation);
+        return APP_ERROR_CREATE_IMAGE_VIEWS_CREATE;
+    }
+
+    pool->current = pool->count;
+    pool->count += 1;
+    app->color_image = entry->image;
+    app->color_image_view = entry->view;
+
+    // report once the image has been rendered to by a few frames
+    app->transient_report_value = app->frame_counter + app->frames.len;
+
+    return 0;
+}
+
+static int create_buffer(
+    VulkanApp *app,
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    MemoryUsage memory_usage,
+    MemoryCategory category,
+    VkBuffer *buffer,
+    DeviceAllocation *allocation
+) {
+    VkBufferCreateInfo buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    VkResult result = vkCreateBuffer(
+        app->device,
+        &buffer_info,
+        app->allocator,
+        buffer
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_CREATE_BUFFER_CREATE;
+    }
+
+    VkMemoryRequirements mem_requirements;
+    vkGetBufferMemoryRequirements(
+        app->device,
+        *buffer,
+        &mem_requirements
+    );
+
+    int error = device_memory_alloc(
+        app,
+        &mem_requirements,
+        memory_usage,
+        MEMORY_RANGE_LINEAR,
+        category,
+        allocation
+    );
+    if (error != 0) {
+        return error;
+    }
+
+    result = vkBindBufferMemory(
+        app->device,
+        *buffer,
+        allocation->memory,
+        allocation->offset
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_DEVICE_MEMORY_BIND;
     }
 
     return 0;
 }
 
-static int create_descriptor_sets(VulkanApp *app) {
-    VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-        layouts[i] = app->descriptor_set_layout;
+// Bump allocate `size` bytes, wrapping around to the start of the ring when
+// the end is reached. The bytes consumed, including any skipped at the end,
+// are added to `usage` so they can be released once the GPU is done
+static int buffer_ring_alloc(
+    BufferRing *ring,
+    VkDeviceSize size,
+    VkDeviceSize *usage,
+    VkDeviceSize *offset
+) {
+    VkDeviceSize aligned_size = align_device_size(size, ring->alignment);
+    VkDeviceSize consumed = aligned_size;
+    VkDeviceSize start = ring->head;
+    if (start + aligned_size > ring->size) {
+        consumed += ring->size - start;
+        start = 0;
+    }
+    if (ring->used + consumed > ring->size) {
+        return APP_ERROR_BUFFER_RING_FULL;
     }
 
-    VkDescriptorSetAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = app->descriptor_pool,
-        .descriptorSetCount = MAX_FRAMES_IN_FLIGHT,
-        .pSetLayouts = layouts,
+    ring->head = start + aligned_size;
+    ring->used += consumed;
+    *usage += consumed;
+    *offset = start;
+
+    return 0;
+}
+
+// Allocate the largest contiguous piece of at most `max_size` bytes that is
+// free right now, returning false if the ring is full
+static bool buffer_ring_alloc_partial(
+    BufferRing *ring,
+    VkDeviceSize max_size,
+    VkDeviceSize *size,
+    VkDeviceSize *usage,
+    VkDeviceSize *offset
+) {
+    VkDeviceSize free_size = ring->size - ring->used;
+    VkDeviceSize to_end = ring->size - ring->head;
+
+    VkDeviceSize start = ring->head;
+    VkDeviceSize skipped = 0;
+    VkDeviceSize available = min(to_end, free_size);
+    if (available < max_size and free_size > to_end) {
+        VkDeviceSize after_wrap = free_size - to_end;
+        if (after_wrap > available) {
+            start = 0;
+            skipped = to_end;
+            available = after_wrap;
+        }
+    }
+
+    available &= ~(ring->alignment - 1);
+    if (available == 0) {
+        return false;
+    }
+
+    *size = min(max_size, available);
+    VkDeviceSize aligned_size = min(
+        align_device_size(*size, ring->alignment),
+        available
+    );
+
+    ring->head = start + aligned_size;
+    ring->used += skipped + aligned_size;
+    *usage += skipped + aligned_size;
+    *offset = start;
+
+    return true;
+}
+
+static void buffer_ring_release(BufferRing *ring, VkDeviceSize *usage) {
+    assert(ring->used >= *usage);
+    ring->used -= *usage;
+    *usage = 0;
+}
+
+static int create_upload_queue(VulkanApp *app) {
+    UploadQueue *uploads = &app->uploads;
+
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+            VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = app->transfer_family,
     };
+    VkResult result = vkCreateCommandPool(
+        app->device,
+        &pool_info,
+        app->allocator,
+        &uploads->command_pool
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_CREATE_UPLOAD_QUEUE_POOL;
+    }
 
-    VkResult result = vkAllocateDescriptorSets(
+    VkCommandBuffer command_buffers[MAX_UPLOAD_SUBMISSIONS];
+    VkCommandBufferAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandPool = uploads->command_pool,
+        .commandBufferCount = MAX_UPLOAD_SUBMISSIONS,
+    };
+    result = vkAllocateCommandBuffers(
         app->device,
         &alloc_info,
-        app->descriptor_sets
+        command_buffers
     );
     if (result != VK_SUCCESS) {
-        return APP_ERROR_CREATE_DESCRIPTOR_SETS;
+        return APP_ERROR_CREATE_UPLOAD_QUEUE_ALLOCATE;
     }
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-        VkDescriptorBufferInfo buffer_info = {
-            .buffer = app->uniform_buffers[i],
-            .offset = 0,
-            .range = sizeof(UniformBufferObject),
-        };
-        
-        VkWriteDescriptorSet descriptor_write = {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = app->descriptor_sets[i],
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = 1,
-            .pBufferInfo = &buffer_info,
+    for (uint32_t i = 0; i < MAX_UPLOAD_SUBMISSIONS; ++i) {
+        uploads->submissions[i] = (UploadSubmission){
+            .command_buffer = command_buffers[i],
         };
+    }
+
+    VkSemaphoreTypeCreateInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &timeline_info,
+    };
+    result = vkCreateSemaphore(
+        app->device,
+        &semaphore_info,
+        app->allocator,
+        &uploads->semaphore
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_CREATE_UPLOAD_QUEUE_SEMAPHORE;
+    }
+
+    // nothing is staged when geometry is written directly
+    if (app->device_memory.direct_write) {
+        return 0;
+    }
+
+    uploads->staging.size = STAGING_RING_SIZE;
+    uploads->staging.alignment = STAGING_RING_ALIGNMENT;
+    return create_buffer(
+        app,
+        uploads->staging.size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        MEMORY_USAGE_UPLOAD,
+        MEMORY_CATEGORY_STAGING,
+        &uploads->staging.buffer,
+        &uploads->staging.allocation
+    );
+}
+
+// Queue a copy of `size` bytes at `data` into the device local `buffer`,
+// which will be read at `dst_stage` with `dst_access` once uploaded
+static int upload_buffer(
+    VulkanApp *app,
+    VkBuffer buffer,
+    const void *data,
+    VkDeviceSize size,
+    VkPipelineStageFlags2 dst_stage,
+    VkAccessFlags2 dst_access
+) {
+    UploadQueue *uploads = &app->uploads;
+    if (size == 0) {
+        return 0;
+    }
+    size_t outstanding = uploads->queued.len + uploads->in_flight.len +
+        uploads->acquiring.len + 1;
+    if (
+        !vec_reserve(uploads->queued, outstanding, &uploads->arena) or
+        !vec_reserve(uploads->in_flight, outstanding, &uploads->arena) or
+        !vec_reserve(uploads->acquiring, outstanding, &uploads->arena) or
+        !vec_reserve(uploads->barriers, outstanding, &uploads->arena)
+    ) {
+        return APP_ERROR_UPLOAD_BUFFER_FULL;
+    }
+
+    BufferUpload *upload = pool_create(
+        BufferUpload,
+        &uploads->pool,
+        &uploads->arena
+    );
+    if (upload == NULL) {
+        return APP_ERROR_UPLOAD_BUFFER_ALLOC;
+    }
+    *vec_push(uploads->queued, &uploads->arena) = upload;
+    *upload = (BufferUpload){
+        .buffer = buffer,
+        .data = data,
+        .size = size,
+        .dst_stage = dst_stage,
+        .dst_access = dst_access,
+    };
+
+    return 0;
+}
+
+// Both halves of a queue family ownership transfer use the same barrier,
+// the release on the transfer queue only fills in the source scope and the
+// acquire on the graphics queue only the destination scope
+static VkBufferMemoryBarrier2 upload_ownership_barrier(
+    VulkanApp *app,
+    BufferUpload *upload,
+    bool release
+) {
+    VkBufferMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+        .srcQueueFamilyIndex = app->transfer_family,
+        .dstQueueFamilyIndex = app->graphics_family,
+        .buffer = upload->buffer,
+        .offset = 0,
+        .size = upload->size,
+    };
+    if (release) {
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    } else {
+        barrier.dstStageMask = upload->dst_stage;
+        barrier.dstAccessMask = upload->dst_access;
+    }
+    return barrier;
+}
 
-        vkUpdateDescriptorSets(app->device, 1, &descriptor_write, 0, NULL);
+// Release the staging space of every submission the transfer queue is done
+// with, and move finished uploads over to be acquired by the next frame
+static int poll_uploads(VulkanApp *app) {
+    UploadQueue *uploads = &app->uploads;
+    if (uploads->completed_value == uploads->submitted_value) {
+        return 0;
     }
 
-    return 0;
+    VkResult result = vkGetSemaphoreCounterValue(
+        app->device,
+        uploads->semaphore,
+        &uploads->completed_value
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_POLL_UPLOADS;
+    }
+
+    for (uint32_t i = 0; i < MAX_UPLOAD_SUBMISSIONS; ++i) {
+        UploadSubmission *submission = &uploads->submissions[i];
+        if (submission->value <= uploads->completed_value) {
+            buffer_ring_release(
+                &uploads->staging,
+                &submission->staging_usage
+            );
+        }
+    }
+
+    size_t in_flight_count = 0;
+    for (size_t i = 0; i < uploads->in_flight.len; ++i) {
+        BufferUpload *upload = slice_get(uploads->in_flight, i);
+        if (upload->value > uploads->completed_value) {
+            uploads->in_flight.ptr[in_flight_count++] = upload;
+            continue;
+        }
+
+        *vec_push(uploads->acquiring, &uploads->arena) = upload;
+        uploads->acquire_value = max(uploads->acquire_value, upload->value);
+    }
+    uploads->in_flight.len = in_flight_count;
+
+    return 0;
+}
+
+// Copy as much of the queued uploads as fits into the staging ring and
+// submit it as a single batch on the transfer queue. Does nothing while all
+// submissions are still in flight
+static int flush_uploads(VulkanApp *app) {
+    UploadQueue *uploads = &app->uploads;
+    if (uploads->queued.len == 0) {
+        return 0;
+    }
+
+    int error = poll_uploads(app);
+    if (error != 0) {
+        return error;
+    }
+
+    UploadSubmission *submission =
+        &uploads->submissions[uploads->next_submission];
+    if (submission->value > uploads->completed_value) {
+        return 0;
+    }
+
+    VkCommandBuffer command_buffer = submission->command_buffer;
+    vkResetCommandBuffer(command_buffer, 0);
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_FLUSH_UPLOADS_COMMAND;
+    }
+
+    uint64_t value = uploads->submitted_value + 1;
+    unsigned char *staging = uploads->staging.allocation.mapped;
+    vec_clear(uploads->barriers);
+    uint32_t copy_count = 0;
+    size_t queued_count = 0;
+    for (size_t i = 0; i < uploads->queued.len; ++i) {
+        BufferUpload *upload = slice_get(uploads->queued, i);
+
+        while (upload->uploaded < upload->size) {
+            VkDeviceSize size;
+            VkDeviceSize offset;
+            bool allocated = buffer_ring_alloc_partial(
+                &uploads->staging,
+                upload->size - upload->uploaded,
+                &size,
+                &submission->staging_usage,
+                &offset
+            );
+            if (!allocated) {
+                break;
+            }
+
+            memcpy(
+                staging + offset,
+                (const unsigned char *)upload->data + upload->uploaded,
+                (size_t)size
+            );
+
+            VkBufferCopy copy_region = {
+                .srcOffset = offset,
+                .dstOffset = upload->uploaded,
+                .size = size,
+            };
+            vkCmdCopyBuffer(
+                command_buffer,
+                uploads->staging.buffer,
+                upload->buffer,
+                1,
+                &copy_region
+            );
+            upload->uploaded += size;
+            copy_count += 1;
+        }
+
+        if (upload->uploaded < upload->size) {
+            uploads->queued.ptr[queued_count++] = upload;
+            continue;
+        }
+
+        upload->value = value;
+        VkBufferMemoryBarrier2 *barrier = vec_push(
+            uploads->barriers,
+            &uploads->arena
+        );
+        *barrier = upload_ownership_barrier(app, upload, true);
+        *vec_push(uploads->in_flight, &uploads->arena) = upload;
+    }
+    uploads->queued.len = queued_count;
+
+    // with a single queue family the semaphore alone orders the copies
+    // before the reads, otherwise ownership has to be released here
+    if (
+        app->transfer_family != app->graphics_family and
+        uploads->barriers.len > 0
+    ) {
+        VkDependencyInfo dependency_info = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .bufferMemoryBarrierCount = (uint32_t)uploads->barriers.len,
+            .pBufferMemoryBarriers = uploads->barriers.ptr,
+        };
+        vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+    }
+
+    result = vkEndCommandBuffer(command_buffer);
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_FLUSH_UPLOADS_COMMAND;
+    }
+
+    // the staging ring is full of copies that are still in flight
+    if (copy_count == 0) {
+        return 0;
+    }
+
+    VkCommandBufferSubmitInfo command_buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = command_buffer,
+    };
+    VkSemaphoreSubmitInfo signal_semaphore = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = uploads->semaphore,
+        .value = value,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+    };
+    VkSubmitInfo2 submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &command_buffer_info,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = &signal_semaphore,
+    };
+    result = vkQueueSubmit2(app->transfer_queue, 1, &submit_info, NULL);
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_FLUSH_UPLOADS_SUBMIT;
+    }
+
+    submission->value = value;
+    uploads->submitted_value = value;
+    uploads->next_submission = (uploads->next_submission + 1) %
+        MAX_UPLOAD_SUBMISSIONS;
+
+    return 0;
+}
+
+static bool uploads_pending(UploadQueue *uploads) {
+    return uploads->queued.len > 0 or
+        uploads->in_flight.len > 0 or
+        uploads->acquiring.len > 0;
+}
+
+// The graphics queue has acquired every upload in `acquiring`
+static void uploads_acquired(UploadQueue *uploads) {
+    for (size_t i = 0; i < uploads->acquiring.len; ++i) {
+        pool_free(&uploads->pool, slice_get(uploads->acquiring, i));
+    }
+    vec_clear(uploads->acquiring);
+}
+
+static void cmd_acquire_uploads(
+    VulkanApp *app,
+    VkCommandBuffer command_buffer
+) {
+    UploadQueue *uploads = &app->uploads;
+    if (app->transfer_family == app->graphics_family) {
+        return;
+    }
+
+    vec_clear(uploads->barriers);
+    for (size_t i = 0; i < uploads->acquiring.len; ++i) {
+        VkBufferMemoryBarrier2 *barrier = vec_push(
+            uploads->barriers,
+            &uploads->arena
+        );
+        *barrier = upload_ownership_barrier(
+            app,
+            slice_get(uploads->acquiring, i),
+            false
+        );
+    }
+
+    VkDependencyInfo dependency_info = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = (uint32_t)uploads->barriers.len,
+        .pBufferMemoryBarriers = uploads->barriers.ptr,
+    };
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+}
+
+static void cleanup_upload_queue(VulkanApp *app) {
+    UploadQueue *uploads = &app->uploads;
+    vkDestroyBuffer(app->device, uploads->staging.buffer, app->allocator);
+    device_memory_free(app, &uploads->staging.allocation);
+    vkDestroySemaphore(app->device, uploads->semaphore, app->allocator);
+    vkDestroyCommandPool(app->device, uploads->command_pool, app->allocator);
+}
+
+// Create a buffer that the GPU only reads, filled with `size` bytes from
+// `data`. With direct writes the data is copied straight into device memory,
+// otherwise it goes through the upload queue
+static int create_static_buffer(
+    VulkanApp *app,
+    const void *data,
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    VkPipelineStageFlags2 dst_stage,
+    VkAccessFlags2 dst_access,
+    VkBuffer *buffer,
+    DeviceAllocation *allocation
+) {
+    if (app->device_memory.direct_write) {
+        int error = create_buffer(
+            app,
+            size,
+            usage,
+            MEMORY_USAGE_DYNAMIC,
+            MEMORY_CATEGORY_GEOMETRY,
+            buffer,
+            allocation
+        );
+        if (error != 0) {
+            return error;
+        }
+
+        assert(allocation->mapped != NULL);
+        memcpy(allocation->mapped, data, (size_t)size);
+        return 0;
+    }
+
+    int error = create_buffer(
+        app,
+        size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
+        MEMORY_USAGE_GPU_ONLY,
+        MEMORY_CATEGORY_GEOMETRY,
+        buffer,
+        allocation
+    );
+    if (error != 0) {
+        return error;
+    }
+
+    return upload_buffer(app, *buffer, data, size, dst_stage, dst_access);
+}
+
+static int create_vertex_buffer(VulkanApp *app) {
+    return create_static_buffer(
+        app,
+        VERTICES,
+        sizeof(VERTICES),
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT,
+        VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT,
+        &app->vertex_buffer,
+        &app->vertex_buffer_allocation
+    );
+}
+
+static int create_index_buffer(VulkanApp *app) {
+    return create_static_buffer(
+        app,
+        INDICES,
+        sizeof(INDICES),
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+        VK_ACCESS_2_INDEX_READ_BIT,
+        &app->index_buffer,
+        &app->index_buffer_allocation
+    );
+}
+
+static int create_command_buffers(VulkanApp *app, Arena temp_arena) {
+    VkCommandBuffer *command_buffers = arena_create_array(
+        VkCommandBuffer,
+        &temp_arena,
+        app->frames.len
+    );
+    if (command_buffers == NULL) {
+        return APP_ERROR_CREATE_COMMAND_BUFFER_ALLOC;
+    }
+
+    VkCommandBufferAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = app->command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = (uint32_t)app->frames.len,
+    };
+
+    VkResult result = vkAllocateCommandBuffers(
+        app->device,
+        &alloc_info,
+        command_buffers
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_CREATE_COMMAND_BUFFER;
+    }
+
+    for (size_t i = 0; i < app->frames.len; ++i) {
+        slice_get(app->frames, i).command_buffer = command_buffers[i];
+    }
+
+    for (size_t i = 0; i < app->frames.len; ++i) {
+        FrameData *frame = &slice_get(app->frames, i);
+        for (uint32_t j = 0; j < app->options.record_threads; ++j) {
+            VkCommandBufferAllocateInfo secondary_alloc_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = frame->record_command_pools[j],
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+            };
+
+            result = vkAllocateCommandBuffers(
+                app->device,
+                &secondary_alloc_info,
+                &frame->secondary_command_buffers[j]
+            );
+            if (result != VK_SUCCESS) {
+                return APP_ERROR_CREATE_COMMAND_BUFFER;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int create_sync_objects(VulkanApp *app) {
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    };
+
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+    };
+
+    for (size_t i = 0; i < app->frames.len; ++i) {
+        FrameData *frame = &slice_get(app->frames, i);
+
+        VkResult result = vkCreateSemaphore(
+            app->device,
+            &semaphore_info,
+            app->allocator,
+            &frame->image_available_semaphore
+        );
+        if (result != VK_SUCCESS) {
+            return APP_ERROR_CREATE_SYNC_OBJECTS_AVAILABLE;
+        }
+        
+        result = vkCreateSemaphore(
+            app->device,
+            &semaphore_info,
+            app->allocator,
+            &frame->render_finished_semaphore
+        );
+        if (result != VK_SUCCESS) {
+            return APP_ERROR_CREATE_SYNC_OBJECTS_FINISHED;
+        }
+
+        if (app->options.sync_mode == FRAME_SYNC_FENCES) {
+            result = vkCreateFence(
+                app->device,
+                &fence_info,
+                app->allocator,
+                &frame->in_flight_fence
+            );
+            if (result != VK_SUCCESS) {
+                return APP_ERROR_CREATE_SYNC_OBJECTS_FENCE;
+            }
+        }
+    }
+
+    if (app->options.sync_mode == FRAME_SYNC_TIMELINE) {
+        VkSemaphoreTypeCreateInfo type_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+            .initialValue = 0,
+        };
+        VkSemaphoreCreateInfo timeline_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &type_info,
+        };
+
+        VkResult result = vkCreateSemaphore(
+            app->device,
+            &timeline_info,
+            app->allocator,
+            &app->frame_timeline
+        );
+        if (result != VK_SUCCESS) {
+            return APP_ERROR_CREATE_SYNC_OBJECTS_TIMELINE;
+        }
+    }
+
+    return 0;
+}
+
+// Block until the GPU has finished every frame up to and including `value`
+static int wait_for_frame_value(VulkanApp *app, uint64_t value) {
+    if (value <= app->completed_frame) {
+        return 0;
+    }
+
+    if (app->options.sync_mode == FRAME_SYNC_TIMELINE) {
+        VkSemaphoreWaitInfo wait_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .semaphoreCount = 1,
+            .pSemaphores = &app->frame_timeline,
+            .pValues = &value,
+        };
+        VkResult result = vkWaitSemaphores(app->device, &wait_info, UINT64_MAX);
+        if (result != VK_SUCCESS) {
+            return APP_ERROR_WAIT_FOR_FRAME;
+        }
+
+        app->completed_frame = value;
+        return 0;
+    }
+
+    // queue submission order means waiting on the fence of the frame that
+    // signaled the largest value <= `value` covers every earlier frame too
+    FrameData *newest = NULL;
+    for (size_t i = 0; i < app->frames.len; ++i) {
+        FrameData *frame = &slice_get(app->frames, i);
+        if (
+            frame->frame_value <= value and
+            frame->frame_value > app->completed_frame and
+            (newest == NULL or frame->frame_value > newest->frame_value)
+        ) {
+            newest = frame;
+        }
+    }
+    if (newest == NULL) {
+        return 0;
+    }
+
+    VkResult result = vkWaitForFences(
+        app->device,
+        1,
+        &newest->in_flight_fence,
+        VK_TRUE,
+        UINT64_MAX
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_WAIT_FOR_FRAME;
+    }
+
+    app->completed_frame = newest->frame_value;
+    return 0;
+}
+
+// Size the ring so that every frame in flight can hold its frame constants
+// and one block per draw, plus one frame worth of slack lost to wrapping
+static int create_uniform_ring(VulkanApp *app) {
+    BufferRing *ring = &app->uniform_ring;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(app->physical_device, &properties);
+    ring->alignment = max(
+        properties.limits.minUniformBufferOffsetAlignment,
+        (VkDeviceSize)1
+    );
+
+    app->draw_stride = align_device_size(
+        sizeof(DrawConstants),
+        ring->alignment
+    );
+    VkDeviceSize frame_size = align_device_size(
+        sizeof(UniformBufferObject),
+        ring->alignment
+    ) + app->draw_stride * app->draws.len;
+    ring->size = frame_size * (app->frames.len + 1);
+
+    return create_buffer(
+        app,
+        ring->size,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        MEMORY_USAGE_DYNAMIC,
+        MEMORY_CATEGORY_UNIFORM,
+        &ring->buffer,
+        &ring->allocation
+    );
+}
+
+static int create_descriptor_pool(VulkanApp *app) {
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .descriptorCount = 2,
+    };
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+        .maxSets = 1,
+    };
+
+    VkResult result = vkCreateDescriptorPool(
+        app->device,
+        &pool_info,
+        app->allocator,
+        &app->descriptor_pool
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_CREATE_DESCRIPTOR_POOL;
+    }
+
+    return 0;
+}
+
+static int create_descriptor_set(VulkanApp *app) {
+    VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = app->descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &app->descriptor_set_layout,
+    };
+
+    VkResult result = vkAllocateDescriptorSets(
+        app->device,
+        &alloc_info,
+        &app->descriptor_set
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_CREATE_DESCRIPTOR_SETS;
+    }
+
+    VkDescriptorBufferInfo buffer_infos[] = {
+        {
+            .buffer = app->uniform_ring.buffer,
+            .offset = 0,
+            .range = sizeof(UniformBufferObject),
+        },
+        {
+            .buffer = app->uniform_ring.buffer,
+            .offset = 0,
+            .range = sizeof(DrawConstants),
+        },
+    };
+
+    VkWriteDescriptorSet descriptor_writes[countof(buffer_infos)];
+    for (uint32_t i = 0; i < countof(buffer_infos); ++i) {
+        descriptor_writes[i] = (VkWriteDescriptorSet){
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = app->descriptor_set,
+            .dstBinding = i,
+            .dstArrayElement = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .pBufferInfo = &buffer_infos[i],
+        };
+    }
+
+    vkUpdateDescriptorSets(
+        app->device,
+        countof(descriptor_writes),
+        descriptor_writes,
+        0,
+        NULL
+    );
+
+    return 0;
+}
+
+// How an attachment image is accessed at some point in the frame, the
+// barrier builder derives minimal stage and access masks from a pair of them
+typedef enum {
+    // freshly acquired from the swapchain: the acquire semaphore is waited
+    // on at the color attachment output stage, so chain off that stage
+    IMAGE_USAGE_ACQUIRED = 0,
+    // written as a color or resolve attachment with a CLEAR or DONT_CARE
+    // load op, so no prior contents are read
+    IMAGE_USAGE_COLOR_ATTACHMENT,
+    // handed to the presentation engine, which is ordered by the semaphore.
+    // The transition ends at the stage the semaphore is signalled at, so
+    // the signal's first scope includes it
+    IMAGE_USAGE_PRESENT,
+} ImageUsage;
+
+typedef struct {
+    VkPipelineStageFlags2 stage;
+    VkAccessFlags2 access;
+    VkImageLayout layout;
+} ImageUsageInfo;
+
+const ImageUsageInfo IMAGE_USAGE_INFOS[] = {
+    [IMAGE_USAGE_ACQUIRED] = {
+        .stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .access = VK_ACCESS_2_NONE,
+        .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+    },
+    [IMAGE_USAGE_COLOR_ATTACHMENT] = {
+        .stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .access = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    },
+    [IMAGE_USAGE_PRESENT] = {
+        .stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .access = VK_ACCESS_2_NONE,
+        .layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    },
+};
+
+#define ACCESS_2_WRITE_MASK ( \
+        VK_ACCESS_2_SHADER_WRITE_BIT | \
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | \
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | \
+        VK_ACCESS_2_TRANSFER_WRITE_BIT | \
+        VK_ACCESS_2_HOST_WRITE_BIT | \
+        VK_ACCESS_2_MEMORY_WRITE_BIT \
+    )
+
+// Only writes have to be made available, and when `discard` is set the
+// old contents are dropped by transitioning out of the undefined layout
+static VkImageMemoryBarrier2 image_barrier(
+    VkImage image,
+    ImageUsage src_usage,
+    ImageUsage dst_usage,
+    bool discard
+) {
+    const ImageUsageInfo *src = &IMAGE_USAGE_INFOS[src_usage];
+    const ImageUsageInfo *dst = &IMAGE_USAGE_INFOS[dst_usage];
+
+    return (VkImageMemoryBarrier2){
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = src->stage,
+        .srcAccessMask = src->access & ACCESS_2_WRITE_MASK,
+        .dstStageMask = dst->stage,
+        .dstAccessMask = dst->access,
+        .oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : src->layout,
+        .newLayout = dst->layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+}
+
+static void cmd_image_barriers(
+    VkCommandBuffer command_buffer,
+    VkImageMemoryBarrier2 *barriers,
+    uint32_t barrier_count
+) {
+    VkDependencyInfo dependency_info = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = barrier_count,
+        .pImageMemoryBarriers = barriers,
+    };
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+}
+
+// Secondary command buffers inherit no state from the primary, so every
+// command buffer that draws sets up the full pipeline state itself
+static void cmd_bind_draw_state(
+    VulkanApp *app,
+    VkCommandBuffer command_buffer
+) {
+    vkCmdBindPipeline(
+        command_buffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        app->graphics_pipeline
+    );
+
+    VkViewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = (float)app->swapchain_extent.width,
+        .height = (float)app->swapchain_extent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {
+        .offset = { 0, 0 },
+        .extent = app->swapchain_extent,
+    };
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+    VkBuffer vertex_buffers[] = { app->vertex_buffer };
+    VkDeviceSize offsets[] = { 0 };
+    assert(countof(vertex_buffers) == countof(offsets));
+
+    vkCmdBindVertexBuffers(
+        command_buffer,
+        0,
+        countof(vertex_buffers),
+        vertex_buffers,
+        offsets
+    );
+
+    assert(sizeof(*INDICES) == sizeof(uint16_t));
+    vkCmdBindIndexBuffer(
+        command_buffer,
+        app->index_buffer,
+        0,
+        VK_INDEX_TYPE_UINT16
+    );
+}
+
+// The dynamic offsets of the whole range are laid out in scratch memory
+// before any command is recorded
+static int cmd_draw_range(
+    VulkanApp *app,
+    VkCommandBuffer command_buffer,
+    FrameData *frame,
+    size_t begin,
+    size_t end
+) {
+    size_t count = end - begin;
+    ArenaMark scratch = scratch_begin(NULL);
+    uint32_t *dynamic_offsets = arena_create_array(
+        uint32_t,
+        scratch.arena,
+        2 * count
+    );
+    if (dynamic_offsets == NULL) {
+        return APP_ERROR_CMD_DRAW_RANGE_ALLOC;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        dynamic_offsets[2 * i] = frame->frame_constants_offset;
+        dynamic_offsets[2 * i + 1] = frame->draw_constants_offset +
+            (uint32_t)((begin + i) * app->draw_stride);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        vkCmdBindDescriptorSets(
+            command_buffer,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            app->pipeline_layout,
+            0,
+            1,
+            &app->descriptor_set,
+            2,
+            &dynamic_offsets[2 * i]
+        );
+        vkCmdDrawIndexed(command_buffer, countof(INDICES), 1, 0, 0, 0);
+    }
+
+    arena_rewind(scratch);
+    return 0;
+}
+
+// Record the slice of the draw list owned by recording thread `index` into
+// that thread's secondary command buffer for `frame`
+static int record_secondary_command_buffer(
+    VulkanApp *app,
+    FrameData *frame,
+    uint32_t index
+) {
+    uint32_t thread_count = app->record_threads.thread_count;
+    size_t begin = app->draws.len * index / thread_count;
+    size_t end = app->draws.len * (index + 1) / thread_count;
+
+    VkResult result = vkResetCommandPool(
+        app->device,
+        frame->record_command_pools[index],
+        0
+    );
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_RECORD_COMMAND_BUFFER_BEGIN;
+    }
+
+    VkCommandBufferInheritanceRenderingInfo inheritance_rendering_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &app->swapchain_image_format,
+        .rasterizationSamples = app->msaa_samples,
+    };
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = &inheritance_rendering_info,
+    };
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+            VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance_info,
+    };
+
+    VkCommandBuffer command_buffer = frame->secondary_command_buffers[index];
+    result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_RECORD_COMMAND_BUFFER_BEGIN;
+    }
+
+    cmd_bind_draw_state(app, command_buffer);
+    int error = cmd_draw_range(app, command_buffer, frame, begin, end);
+    if (error != 0) {
+        return error;
+    }
+
+    result = vkEndCommandBuffer(command_buffer);
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_RECORD_COMMAND_BUFFER_END;
+    }
+
+    return 0;
+}
+
+static void *record_thread(void *arg) {
+    RecordWorker *worker = arg;
+    VulkanApp *app = worker->app;
+    RecordThreads *threads = &app->record_threads;
+    bool scratch_ready = scratch_init(SCRATCH_ARENA_SIZE);
+
+    uint32_t generation = worker->generation;
+    pthread_mutex_lock(&threads->mutex);
+    for (;;) {
+        while (threads->generation == generation and !threads->done) {
+            pthread_cond_wait(&threads->start, &threads->mutex);
+        }
+        if (threads->done) {
+            break;
+        }
+        generation = threads->generation;
+        FrameData *frame = threads->frame;
+        pthread_mutex_unlock(&threads->mutex);
+
+        int error = APP_ERROR_SCRATCH_INIT;
+        if (scratch_ready) {
+            error = record_secondary_command_buffer(app, frame, worker->index);
+        }
+
+        pthread_mutex_lock(&threads->mutex);
+        if (threads->error == 0) {
+            threads->error = error;
+        }
+        threads->pending -= 1;
+        if (threads->pending == 0) {
+            pthread_cond_signal(&threads->finished);
+        }
+    }
+    pthread_mutex_unlock(&threads->mutex);
+
+    scratch_release();
+
+    return NULL;
+}
+
+static void record_threads_stop(RecordThreads *threads) {
+    if (threads->started == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&threads->mutex);
+    threads->done = true;
+    pthread_cond_broadcast(&threads->start);
+    pthread_mutex_unlock(&threads->mutex);
+
+    for (uint32_t i = 1; i < threads->started; ++i) {
+        pthread_join(threads->workers[i].thread, NULL);
+    }
+    threads->started = 0;
+
+    pthread_cond_destroy(&threads->finished);
+    pthread_cond_destroy(&threads->start);
+    pthread_mutex_destroy(&threads->mutex);
+}
+
+static int record_threads_start(VulkanApp *app) {
+    RecordThreads *threads = &app->record_threads;
+    threads->thread_count = app->options.record_threads;
+    threads->done = false;
+    if (threads->thread_count == 0) {
+        return 0;
+    }
+
+    pthread_mutex_init(&threads->mutex, NULL);
+    pthread_cond_init(&threads->start, NULL);
+    pthread_cond_init(&threads->finished, NULL);
+
+    threads->workers[0] = (RecordWorker){ .app = app, .index = 0 };
+    threads->started = 1;
+    for (uint32_t i = 1; i < threads->thread_count; ++i) {
+        RecordWorker *worker = &threads->workers[i];
+        *worker = (RecordWorker){
+            .app = app,
+            .index = i,
+            .generation = threads->generation,
+        };
+
+        int error = pthread_create(
+            &worker->thread,
+            NULL,
+            record_thread,
+            worker
+        );
+        if (error != 0) {
+            record_threads_stop(threads);
+            return APP_ERROR_RECORD_THREADS_START;
+        }
+        threads->started += 1;
+    }
+
+    return 0;
+}
+
+// Record all secondary command buffers for `frame`, the render thread takes
+// the first slice while the workers record the rest
+static int record_threads_run(RecordThreads *threads, FrameData *frame) {
+    pthread_mutex_lock(&threads->mutex);
+    threads->frame = frame;
+    threads->error = 0;
+    threads->pending = threads->thread_count - 1;
+    threads->generation += 1;
+    pthread_cond_broadcast(&threads->start);
+    pthread_mutex_unlock(&threads->mutex);
+
+    int error = record_secondary_command_buffer(
+        threads->workers[0].app,
+        frame,
+        0
+    );
+
+    pthread_mutex_lock(&threads->mutex);
+    while (threads->pending > 0) {
+        pthread_cond_wait(&threads->finished, &threads->mutex);
+    }
+    if (error == 0) {
+        error = threads->error;
+    }
+    pthread_mutex_unlock(&threads->mutex);
+
+    return error;
+}
+
+static int record_command_buffer(
+    VulkanApp *app,
+    FrameData *frame,
+    uint32_t image_index
+) {
+    bool parallel = app->record_threads.thread_count > 0 and
+        app->geometry_ready;
+    if (parallel) {
+        int error = record_threads_run(&app->record_threads, frame);
+        if (error != 0) {
+            return error;
+        }
+    }
+
+    VkCommandBuffer command_buffer = frame->command_buffer;
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = 0,
+        .pInheritanceInfo = NULL,
+    };
+    
+    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_RECORD_COMMAND_BUFFER_BEGIN;
+    }
+
+    {
+        VkImageMemoryBarrier2 barriers[2];
+        uint32_t barrier_count = 0;
+
+        barriers[barrier_count++] = image_barrier(
+            slice_get(app->swapchain_images, image_index),
+            IMAGE_USAGE_ACQUIRED,
+            IMAGE_USAGE_COLOR_ATTACHMENT,
+            true
+        );
+
+        // the multisampled image is shared by all frames in flight, so its
+        // writes have to be ordered after those of the previous frame
+        if (app->msaa_samples != VK_SAMPLE_COUNT_1_BIT) {
+            barriers[barrier_count++] = image_barrier(
+                app->color_image,
+                IMAGE_USAGE_COLOR_ATTACHMENT,
+                IMAGE_USAGE_COLOR_ATTACHMENT,
+                true
+            );
+        }
+
+        cmd_image_barriers(command_buffer, barriers, barrier_count);
+    }
+
+    if (app->uploads.acquiring.len > 0) {
+        cmd_acquire_uploads(app, command_buffer);
+    }
+
+    VkClearValue clear_color = {
+        .color = {
+            .float32 = { 0.0f, 0.0f, 0.0f, 1.0f },
+        },
+    };
+
+    VkRenderingAttachmentInfo attachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = clear_color,
+    };
+    // only the resolved image is used, so the samples can stay in tile
+    // memory instead of being written back
+    if (app->msaa_samples != VK_SAMPLE_COUNT_1_BIT) {
+        attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    }
+    if (app->msaa_samples == VK_SAMPLE_COUNT_1_BIT) {
+        attachment.imageView = slice_get(
+            app->swapchain_image_views,
+            image_index
+        );
+    } else {
+        attachment.imageView = app->color_image_view;
+        attachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+        attachment.resolveImageView = slice_get(
+            app->swapchain_image_views,
+            image_index
+        );
+        attachment.resolveImageLayout =
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+
+    VkRenderingInfo render_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+        .renderArea = {
+            .offset = { 0, 0 },
+            .extent = app->swapchain_extent,
+        },
+        .layerCount = 1,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &attachment,
+    };
+    if (parallel) {
+        render_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+    }
+
+    vkCmdBeginRendering(command_buffer, &render_info);
+
+    if (parallel) {
+        vkCmdExecuteCommands(
+            command_buffer,
+            app->record_threads.thread_count,
+            frame->secondary_command_buffers
+        );
+    } else if (app->geometry_ready) {
+        cmd_bind_draw_state(app, command_buffer);
+        int error = cmd_draw_range(
+            app,
+            command_buffer,
+            frame,
+            0,
+            app->draws.len
+        );
+        if (error != 0) {
+            return error;
+        }
+    }
+
+    vkCmdEndRendering(command_buffer);
+
+    {
+        VkImageMemoryBarrier2 barriers[] = {
+            image_barrier(
+                slice_get(app->swapchain_images, image_index),
+                IMAGE_USAGE_COLOR_ATTACHMENT,
+                IMAGE_USAGE_PRESENT,
+                false
+            ),
+        };
+        cmd_image_barriers(command_buffer, barriers, countof(barriers));
+    }
+
+    result = vkEndCommandBuffer(command_buffer);
+    if (result != VK_SUCCESS) {
+        return APP_ERROR_RECORD_COMMAND_BUFFER_END;
+    }
+
+    return 0;
+}
+
+// The color attachment stays in the attachment pool
+static void cleanup_swapchain(VulkanApp *app) {
+    for (size_t i = 0; i < app->swapchain_image_views.len; ++i) {
+        vkDestroyImageView(
+            app->device,
+            slice_get(app->swapchain_image_views, i),
+            app->allocator
+        );
+    }
+
+    vkDestroySwapchainKHR(app->device, app->swapchain, app->allocator);
+}
+
+void timestep_update(GameData *game_data) {
+    float fdt = (float)(TIMESTEP_NS) / (1000.0f * 1000.0f * 1000.0f);
+
+    if (game_data->freeze) {
+        float acceleration = SQUARE_STOP_ACCELERATION *
+            (0.0f - game_data->rotation_velocity) / SQUARE_MAX_VELOCITY;
+        game_data->rotation_velocity += fdt * acceleration;
+    } else {
+        game_data->rotation_velocity += fdt * SQUARE_ACCELERATION * 
+            (float)game_data->direction;
+    }
+
+    game_data->rotation_velocity = max(
+        min(
+            game_data->rotation_velocity,
+            SQUARE_MAX_VELOCITY
+        ),
+        -1.0f * SQUARE_MAX_VELOCITY
+    );
+
+    // the exponential stop never reaches zero on its own
+    if (
+        game_data->freeze and
+        fabsf(game_data->rotation_velocity) < SQUARE_REST_VELOCITY
+    ) {
+        game_data->rotation_velocity = 0.0f;
+    }
+
+    game_data->rotation_angle += game_data->rotation_velocity * fdt;
+
+    if (game_data->rotation_angle >= 2.0f * AVEN_GLM_PI_F) {
+        game_data->rotation_angle -= 2.0f * AVEN_GLM_PI_F;
+    }
+    if (game_data->rotation_angle < 0.0f) {
+        game_data->rotation_angle += 2.0f * AVEN_GLM_PI_F;
+    }
+}
+
+
+static void game_snapshot_buffer_init(GameSnapshotBuffer *buffer) {
+    *buffer = (GameSnapshotBuffer){ .back = 0, .middle = 1, .front = 2 };
 }
 
-static int record_command_buffer(
-    VulkanApp *app,
-    VkCommandBuffer command_buffer,
-    uint32_t image_index
+static void game_snapshot_buffer_publish(
+    GameSnapshotBuffer *buffer,
+    GameSnapshot *snapshot
 ) {
-    VkCommandBufferBeginInfo begin_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = 0,
-        .pInheritanceInfo = NULL,
-    };
-    
-    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_RECORD_COMMAND_BUFFER_BEGIN;
-    }
-
-    {
-        VkImageMemoryBarrier image_memory_barriers[] = {
-            {
-                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-                .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                .image = slice_get(app->swapchain_images, image_index),
-                .subresourceRange = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .baseMipLevel = 0,
-                    .levelCount = 1,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
-                },
-            }
-        };
+    buffer->slots[buffer->back] = *snapshot;
+    uint32_t previous = atomic_exchange_acq_rel(
+        &buffer->middle,
+        buffer->back | GAME_SNAPSHOT_BUFFER_FRESH_BIT
+    );
+    buffer->back = previous & GAME_SNAPSHOT_BUFFER_INDEX_MASK;
+}
 
-        vkCmdPipelineBarrier(
-            command_buffer,
-            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            0,
-            0,
-            NULL,
-            0,
-            NULL,
-            countof(image_memory_barriers),
-            image_memory_barriers
+static GameSnapshot *game_snapshot_buffer_read(GameSnapshotBuffer *buffer) {
+    uint32_t middle = atomic_load_acquire(&buffer->middle);
+    if (middle & GAME_SNAPSHOT_BUFFER_FRESH_BIT) {
+        uint32_t previous = atomic_exchange_acq_rel(
+            &buffer->middle,
+            buffer->front
         );
+        buffer->front = previous & GAME_SNAPSHOT_BUFFER_INDEX_MASK;
     }
+    return &buffer->slots[buffer->front];
+}
 
-    VkClearValue clear_color = {
-        .color = {
-            .float32 = { 0.0f, 0.0f, 0.0f, 1.0f },
-        },
-    };
+// Blend the previous and current tick by how far `now` is past the newer
+// tick, which renders one timestep in the past but never extrapolates
+static GameData game_snapshot_interpolate(
+    GameSnapshot *snapshot,
+    TimeSpec *now
+) {
+    float alpha = (float)timespec_diff(now, &snapshot->time) /
+        (float)TIMESTEP_NS;
+    alpha = max(min(alpha, 1.0f), 0.0f);
 
-    VkRenderingAttachmentInfo attachment = {
-        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
-        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        .clearValue = clear_color,
-    };
-    if (app->msaa_samples == VK_SAMPLE_COUNT_1_BIT) {
-        attachment.imageView = slice_get(
-            app->swapchain_image_views,
-            image_index
-        );
-    } else {
-        attachment.imageView = app->color_image_view;
-        attachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
-        attachment.resolveImageView = slice_get(
-            app->swapchain_image_views,
-            image_index
-        );
-        attachment.resolveImageLayout =
-            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    GameData game_data = snapshot->current;
+
+    float angle_delta = snapshot->current.rotation_angle -
+        snapshot->previous.rotation_angle;
+    if (angle_delta > AVEN_GLM_PI_F) {
+        angle_delta -= 2.0f * AVEN_GLM_PI_F;
     }
+    if (angle_delta < -AVEN_GLM_PI_F) {
+        angle_delta += 2.0f * AVEN_GLM_PI_F;
+    }
+    game_data.rotation_angle = snapshot->previous.rotation_angle +
+        alpha * angle_delta;
 
-    VkRenderingInfo render_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-        .renderArea = {
-            .offset = { 0, 0 },
-            .extent = app->swapchain_extent,
-        },
-        .layerCount = 1,
-        .colorAttachmentCount = 1,
-        .pColorAttachments = &attachment,
-    };
+    game_data.rotation_velocity = snapshot->previous.rotation_velocity +
+        alpha * (
+            snapshot->current.rotation_velocity -
+            snapshot->previous.rotation_velocity
+        );
 
-    vkCmdBeginRendering(command_buffer, &render_info);
+    return game_data;
+}
 
-    vkCmdBindPipeline(
-        command_buffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        app->graphics_pipeline
-    );
+static bool game_snapshot_at_rest(GameSnapshot *snapshot) {
+    return snapshot->previous.rotation_velocity == 0.0f and
+        snapshot->current.rotation_velocity == 0.0f and
+        snapshot->previous.rotation_angle == snapshot->current.rotation_angle;
+}
 
-    VkViewport viewport = {
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = (float)app->swapchain_extent.width,
-        .height = (float)app->swapchain_extent.height,
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f,
-    };
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+// If the simulation falls further behind than this it drops the backlog
+// instead of trying to catch up in a burst of ticks
+#define SIMULATION_MAX_LAG_NS (250L * 1000L * 1000L)
 
-    VkRect2D scissor = {
-        .offset = { 0, 0 },
-        .extent = app->swapchain_extent,
-    };
-    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+static void *simulation_thread(void *data) {
+    Simulation *simulation = data;
+    GameSnapshot snapshot = { 0 };
 
-    VkBuffer vertex_buffers[] = { app->vertex_buffer };
-    VkDeviceSize offsets[] = { 0 };
-    assert(countof(vertex_buffers) == countof(offsets));
+    TimeSpec next_tick;
+    if (timespec_now(&next_tick) != 0) {
+        simulation->error = APP_ERROR_SIMULATION_CLOCK;
+        return NULL;
+    }
 
-    vkCmdBindVertexBuffers(
-        command_buffer,
-        0,
-        countof(vertex_buffers),
-        vertex_buffers,
-        offsets
-    );
+    while (!atomic_load_acquire(&simulation->done)) {
+        GameData game_data = snapshot.current;
+        game_data.direction = atomic_load_relaxed(
+            &simulation->input_direction
+        );
+        game_data.freeze = atomic_load_relaxed(&simulation->input_freeze) != 0;
 
-    assert(sizeof(*INDICES) == sizeof(uint16_t));
-    vkCmdBindIndexBuffer(
-        command_buffer,
-        app->index_buffer,
-        0,
-        VK_INDEX_TYPE_UINT16
-    );
+        timestep_update(&game_data);
 
-    vkCmdBindDescriptorSets(
-        command_buffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        app->pipeline_layout,
-        0,
-        1,
-        &app->descriptor_sets[app->current_frame],
-        0,
-        NULL
-    );
+        snapshot.previous = snapshot.current;
+        snapshot.current = game_data;
+        snapshot.time = next_tick;
+        game_snapshot_buffer_publish(&simulation->snapshots, &snapshot);
 
-    vkCmdDrawIndexed(command_buffer, countof(INDICES), 1, 0, 0, 0);
+        timespec_add(&next_tick, TIMESTEP_NS);
 
-    vkCmdEndRendering(command_buffer);
+        if (game_snapshot_at_rest(&snapshot)) {
+            pthread_mutex_lock(&simulation->mutex);
+            while (
+                !atomic_load_acquire(&simulation->done) and
+                !simulation_input_moving(simulation)
+            ) {
+                pthread_cond_wait(&simulation->wake, &simulation->mutex);
+            }
+            pthread_mutex_unlock(&simulation->mutex);
 
-    {
-        VkImageMemoryBarrier image_memory_barriers[] = {
-            {
-                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-                .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-                .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-                .image = slice_get(app->swapchain_images, image_index),
-                .subresourceRange = {
-                  .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                  .baseMipLevel = 0,
-                  .levelCount = 1,
-                  .baseArrayLayer = 0,
-                  .layerCount = 1,
-                },
+            if (timespec_now(&next_tick) != 0) {
+                simulation->error = APP_ERROR_SIMULATION_CLOCK;
+                return NULL;
             }
-        };
+            continue;
+        }
 
-        vkCmdPipelineBarrier(
-            command_buffer,
-            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-            0,
-            0,
-            NULL,
-            0,
-            NULL,
-            countof(image_memory_barriers),
-            image_memory_barriers
-        );
+        TimeSpec now;
+        if (timespec_now(&now) != 0) {
+            simulation->error = APP_ERROR_SIMULATION_CLOCK;
+            return NULL;
+        }
+
+        int64_t lag = timespec_diff(&now, &next_tick);
+        if (lag > SIMULATION_MAX_LAG_NS) {
+            next_tick = now;
+        } else if (lag < 0) {
+            timespec_sleep_until(&next_tick);
+        }
     }
- 
-    result = vkEndCommandBuffer(command_buffer);
-    if (result != VK_SUCCESS) {
-        return APP_ERROR_RECORD_COMMAND_BUFFER_END;
+
+    return NULL;
+}
+
+static int simulation_start(Simulation *simulation) {
+    game_snapshot_buffer_init(&simulation->snapshots);
+    atomic_store_release(&simulation->done, 0U);
+
+    pthread_mutex_init(&simulation->mutex, NULL);
+    pthread_cond_init(&simulation->wake, NULL);
+
+    int error = pthread_create(
+        &simulation->thread,
+        NULL,
+        simulation_thread,
+        simulation
+    );
+    if (error != 0) {
+        return APP_ERROR_SIMULATION_START;
     }
 
     return 0;
 }
 
-static void cleanup_swapchain(VulkanApp *app) {
-    if (app->msaa_samples != VK_SAMPLE_COUNT_1_BIT) {
-        vkDestroyImageView(app->device, app->color_image_view, NULL);
-        vkDestroyImage(app->device, app->color_image, NULL);
-        vkFreeMemory(app->device, app->color_image_memory, NULL);
-    }
+static int simulation_stop(Simulation *simulation) {
+    atomic_store_release(&simulation->done, 1U);
+    simulation_wake(simulation);
+    pthread_join(simulation->thread, NULL);
 
-    for (size_t i = 0; i < app->swapchain_image_views.len; ++i) {
-        vkDestroyImageView(
-            app->device,
-            slice_get(app->swapchain_image_views, i),
-            NULL
-        );
-    }
+    pthread_cond_destroy(&simulation->wake);
+    pthread_mutex_destroy(&simulation->mutex);
 
-    vkDestroySwapchainKHR(app->device, app->swapchain, NULL);
+    return simulation->error;
 }
 
-static void update_uniform_buffer(
-    VulkanApp *app,
-    uint32_t current_image
-) {
+// Write the frame constants and the constants of every draw to freshly
+// allocated space in the uniform ring
+static int write_frame_constants(VulkanApp *app, FrameData *frame) {
     float width = (float)app->swapchain_extent.width;
     float height = (float)app->swapchain_extent.height;
     float side = min(width, height);
-    Mat2 view_matrix = { {
-        { { side / width, 0.0f } },
-        { { 0.0f, side / height } }
-    } };
-
-    float sin_rangle = sinf(app->game_data.rotation_angle);
-    float cos_rangle = cosf(app->game_data.rotation_angle);
-    Mat2 rotation_matrix = { {
-        { { cos_rangle, -sin_rangle } },
-        { { sin_rangle, cos_rangle } }
-    } };
+    Mat2 view_matrix = mat2_scaling((Vec2){ { side / width, side / height } });
+
+    GameSnapshot *snapshot = game_snapshot_buffer_read(
+        &app->simulation.snapshots
+    );
+    TimeSpec now;
+    if (timespec_now(&now) != 0) {
+        now = snapshot->time;
+    }
+    GameData game_data = game_snapshot_interpolate(snapshot, &now);
 
     UniformBufferObject ubo = {
-        .view = mat2_mul_mat2(view_matrix, rotation_matrix),
+        .view = view_matrix,
     };
-    memcpy(app->uniform_buffers_mapped[current_image], &ubo, sizeof(ubo));
+
+    BufferRing *ring = &app->uniform_ring;
+    unsigned char *mapped = ring->allocation.mapped;
+
+    VkDeviceSize offset;
+    int error = buffer_ring_alloc(
+        ring,
+        sizeof(ubo),
+        &frame->uniform_ring_usage,
+        &offset
+    );
+    if (error != 0) {
+        return error;
+    }
+    frame->frame_constants_offset = (uint32_t)offset;
+    memcpy(mapped + offset, &ubo, sizeof(ubo));
+
+    error = buffer_ring_alloc(
+        ring,
+        app->draw_stride * app->draws.len,
+        &frame->uniform_ring_usage,
+        &offset
+    );
+    if (error != 0) {
+        return error;
+    }
+    frame->draw_constants_offset = (uint32_t)offset;
+
+    // the game angle turns clockwise
+    DrawStreams *draws = &app->draws;
+    mat2x3_transform_batch(
+        mapped + offset,
+        (size_t)app->draw_stride,
+        draws->angle,
+        draws->scale,
+        draws->x,
+        draws->y,
+        -game_data.rotation_angle,
+        draws->len
+    );
+
+    return 0;
+}
+
+// Print how much memory and bandwidth the transient multisampled image saves
+static void report_transient_memory(VulkanApp *app) {
+    if (
+        app->msaa_samples == VK_SAMPLE_COUNT_1_BIT or
+        app->transient_report_value == 0 or
+        app->completed_frame < app->transient_report_value
+    ) {
+        return;
+    }
+    app->transient_report_value = 0;
+
+    DeviceAllocation *allocation =
+        &app->attachments.entries[app->attachments.current].allocation;
+    DeviceMemoryBlock *block =
+        &app->device_memory.blocks[allocation->block_index];
+    VkMemoryPropertyFlags properties = app->device_memory.memory_properties
+        .memoryTypes[block->memory_type_index].propertyFlags;
+
+    double size_mib = (double)allocation->size / (1024.0 * 1024.0);
+    if (properties & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+        VkDeviceSize committed;
+        vkGetDeviceMemoryCommitment(app->device, block->memory, &committed);
+        printf(
+            "msaa: %ux color attachment lazily allocated, %.2f MiB of"
+                " %.2f MiB committed\n",
+            (unsigned)app->msaa_samples,
+            (double)committed / (1024.0 * 1024.0),
+            size_mib
+        );
+    } else {
+        printf(
+            "msaa: %ux color attachment in %.2f MiB of device memory,"
+                " no lazily allocated memory type\n",
+            (unsigned)app->msaa_samples,
+            size_mib
+        );
+    }
+    printf(
+        "msaa: skipping the store saves up to %.2f MiB of writes per frame\n",
+        size_mib
+    );
 }
 
 static int recreate_swapchain(
@@ -2241,12 +5378,21 @@ static int recreate_swapchain(
 
     vkDeviceWaitIdle(app->device);
 
+    // presents queued to the old swapchain can no longer be waited on
+    app->pending_present_count = 0;
+    app->pacer.has_last_present = false;
+
+    app->redraw_requested = true;
     app->width = (uint32_t)width;
     app->height = (uint32_t)height;
 
     cleanup_swapchain(app);
     *swapchain_arena = app->base_swapchain_arena;
 
+    // the main loop switches back to the frame phase
+    arena_phase(&temp_arena, "swapchain");
+    arena_phase(swapchain_arena, "resize");
+
     int error = create_swapchain(app, swapchain_arena, temp_arena);
     if (error != 0) {
         return error;
@@ -2257,11 +5403,27 @@ static int recreate_swapchain(
         return error;
     }
 
+    // the pipeline is built for a fixed sample count
+    if (choose_msaa_samples(app)) {
+        vkDestroyPipeline(app->device, app->graphics_pipeline, app->allocator);
+        vkDestroyPipelineLayout(
+            app->device,
+            app->pipeline_layout,
+            app->allocator
+        );
+        error = create_graphics_pipeline(app, temp_arena);
+        if (error != 0) {
+            return error;
+        }
+    }
+
     if (app->msaa_samples != VK_SAMPLE_COUNT_1_BIT) {
         error = create_color_resources(app);
         if (error != 0) {
             return error;
         }
+    } else {
+        attachment_pool_cleanup(app);
     }
 
     return 0;
@@ -2277,6 +5439,9 @@ static int init_vulkan(
         return APP_ERROR_INIT_VULKAN_VOLK;
     }
 
+    arena_phase(&temp_arena, "instance");
+    arena_phase(swapchain_arena, "init");
+
     int error = create_instance(app, temp_arena);
     if (error != 0) {
         return error;
@@ -2294,6 +5459,8 @@ static int init_vulkan(
         return error;
     }
 
+    arena_phase(&temp_arena, "device");
+
     error = pick_physical_device(app, temp_arena);
     if (error != 0) {
         return error;
@@ -2304,6 +5471,10 @@ static int init_vulkan(
         return error;
     }
 
+    device_memory_init(app);
+
+    arena_phase(&temp_arena, "swapchain");
+
     error = create_swapchain(app, swapchain_arena, temp_arena);
     if (error != 0) {
         return error;
@@ -2319,11 +5490,22 @@ static int init_vulkan(
         return error;
     }
 
+    choose_msaa_samples(app);
+
+    arena_phase(&temp_arena, "pipeline");
+
+    error = create_pipeline_cache(app, temp_arena);
+    if (error != 0) {
+        return error;
+    }
+
     error = create_graphics_pipeline(app, temp_arena);
     if (error != 0) {
         return error;
     }
 
+    arena_phase(&temp_arena, "resources");
+
     error = create_command_pool(app, temp_arena);
     if (error != 0) {
         return error;
@@ -2336,6 +5518,11 @@ static int init_vulkan(
         }
     }
     
+    error = create_upload_queue(app);
+    if (error != 0) {
+        return error;
+    }
+
     error = create_vertex_buffer(app);
     if (error != 0) {
         return error;
@@ -2346,7 +5533,14 @@ static int init_vulkan(
         return error;
     }
 
-    error = create_uniform_buffers(app);
+    error = flush_uploads(app);
+    if (error != 0) {
+        return error;
+    }
+    // directly written geometry is visible to the first submission
+    app->geometry_ready = !uploads_pending(&app->uploads);
+
+    error = create_uniform_ring(app);
     if (error != 0) {
         return error;
     }
@@ -2356,19 +5550,160 @@ static int init_vulkan(
         return error;
     }
 
-    error = create_descriptor_sets(app);
+    error = create_descriptor_set(app);
+    if (error != 0) {
+        return error;
+    }
+
+    error = create_command_buffers(app, temp_arena);
     if (error != 0) {
         return error;
     }
 
-    error = create_command_buffers(app);
+    error = create_sync_objects(app);
     if (error != 0) {
         return error;
     }
 
-    error = create_sync_objects(app);
-    if (error != 0) {
-        return error;
+    return 0;
+}
+
+// Account for a frame that reached the display at `present_time`, which is
+// measured with present wait or else estimated from CPU side timing
+static void frame_pacer_presented(
+    FramePacer *pacer,
+    PendingPresent *present,
+    TimeSpec *present_time
+) {
+    int64_t latency = timespec_diff(present_time, &present->frame_start);
+    pacer->report_latency += latency;
+    pacer->report_presents += 1;
+
+    if (present->has_input) {
+        int64_t input_latency = timespec_diff(
+            present_time,
+            &present->input_time
+        );
+        pacer->report_input_latency += input_latency;
+        pacer->report_max_input_latency = max(
+            pacer->report_max_input_latency,
+            input_latency
+        );
+        pacer->report_inputs += 1;
+    }
+
+    if (!pacer->present_timing) {
+        return;
+    }
+
+    if (pacer->has_last_present) {
+        int64_t interval = timespec_diff(present_time, &pacer->last_present);
+        interval = min(
+            max(interval, pacer->min_interval),
+            4 * pacer->min_interval
+        );
+        pacer->frame_interval += (interval - pacer->frame_interval) / 8;
+    }
+    pacer->last_present = *present_time;
+    pacer->has_last_present = true;
+
+    // a frame that took longer than a refresh interval to show up missed
+    // the deadline it was started for
+    if (latency > pacer->frame_interval) {
+        pacer->margin = min(
+            pacer->margin + 10 * FRAME_PACER_MARGIN_STEP_NS,
+            pacer->frame_interval / 2
+        );
+    } else {
+        pacer->margin = max(
+            pacer->margin - FRAME_PACER_MARGIN_STEP_NS,
+            FRAME_PACER_MIN_MARGIN_NS
+        );
+    }
+}
+
+static void track_present(VulkanApp *app, uint64_t present_id) {
+    PendingPresent present = {
+        .id = present_id,
+        .frame_start = app->pacer.frame_start,
+        .input_time = app->frame_input_time,
+        .has_input = app->frame_has_input,
+    };
+    app->frame_has_input = false;
+
+    // without present wait, assume the frame shows up on the first refresh
+    // after the CPU is done with it
+    if (!app->present_wait_supported) {
+        TimeSpec present_time;
+        if (timespec_now(&present_time) == 0) {
+            timespec_add(&present_time, app->pacer.frame_interval);
+            frame_pacer_presented(&app->pacer, &present, &present_time);
+        }
+        return;
+    }
+
+    if (app->pending_present_count == MAX_PENDING_PRESENTS) {
+        app->pending_present_head = (app->pending_present_head + 1) %
+            MAX_PENDING_PRESENTS;
+        app->pending_present_count -= 1;
+    }
+
+    uint32_t index = (app->pending_present_head + app->pending_present_count) %
+        MAX_PENDING_PRESENTS;
+    app->pending_presents[index] = present;
+    app->pending_present_count += 1;
+}
+
+// Retire presents that reached the display. When `block` is set this waits
+// (for at most a few refresh intervals) until the newest one is shown, which
+// keeps at most one frame queued and gives accurate completion times
+static int collect_presents(VulkanApp *app, bool block) {
+    while (app->pending_present_count > 0) {
+        uint32_t index = app->pending_present_head;
+        uint64_t timeout = 0;
+        if (block) {
+            index = (index + app->pending_present_count - 1) %
+                MAX_PENDING_PRESENTS;
+            timeout = (uint64_t)(4 * app->pacer.frame_interval);
+        }
+        PendingPresent *present = &app->pending_presents[index];
+
+        VkResult result = vkWaitForPresentKHR(
+            app->device,
+            app->swapchain,
+            present->id,
+            timeout
+        );
+        if (result == VK_TIMEOUT) {
+            return 0;
+        }
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            app->pending_present_count = 0;
+            return 0;
+        }
+        if (result != VK_SUCCESS and result != VK_SUBOPTIMAL_KHR) {
+            return APP_ERROR_WAIT_FOR_PRESENT;
+        }
+
+        TimeSpec now;
+        if (timespec_now(&now) != 0) {
+            return APP_ERROR_FRAME_PACER_CLOCK;
+        }
+
+        // a present wait also covers every earlier present id
+        while (
+            app->pending_present_count > 0 and
+            app->pending_presents[app->pending_present_head].id <= present->id
+        ) {
+            frame_pacer_presented(
+                &app->pacer,
+                &app->pending_presents[app->pending_present_head],
+                &now
+            );
+            app->pending_present_head = (app->pending_present_head + 1) %
+                MAX_PENDING_PRESENTS;
+            app->pending_present_count -= 1;
+        }
     }
 
     return 0;
@@ -2379,100 +5714,165 @@ static int draw_frame(
     Arena *swapchain_arena,
     Arena temp_arena
 ) {
-    VkResult result = vkWaitForFences(
-        app->device,
-        1,
-        &app->in_flight_fences[app->current_frame],
-        VK_TRUE,
-        TIMESTEP_NS
-    );
-    if (result != VK_SUCCESS) {
-        if (result == VK_TIMEOUT) {
-            return 0;
-        }
+    FrameData *frame = &slice_get(app->frames, app->current_frame);
 
-        return APP_ERROR_DRAW_FRAME_FENCE;
+    int error = wait_for_frame_value(app, frame->frame_value);
+    if (error != 0) {
+        return error;
     }
 
     uint32_t image_index;
-    result = vkAcquireNextImageKHR(
+    VkResult result = vkAcquireNextImageKHR(
         app->device,
         app->swapchain,
-        TIMESTEP_NS,
-        app->image_available_semaphores[app->current_frame],
+        UINT64_MAX,
+        frame->image_available_semaphore,
         VK_NULL_HANDLE,
         &image_index
     );
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
         return recreate_swapchain(app, swapchain_arena, temp_arena);
-    } else if (result == VK_TIMEOUT) {
-        return 0;
     } else if (result != VK_SUCCESS and result != VK_SUBOPTIMAL_KHR) {
         return APP_ERROR_DRAW_FRAME_SWAPCHAIN;
     }
 
-    update_uniform_buffer(app, app->current_frame);
+    report_transient_memory(app);
 
-    vkResetFences(app->device, 1, &app->in_flight_fences[app->current_frame]);
+    buffer_ring_release(&app->uniform_ring, &frame->uniform_ring_usage);
+    error = write_frame_constants(app, frame);
+    if (error != 0) {
+        return error;
+    }
 
-    vkResetCommandBuffer(app->command_buffers[app->current_frame], 0);
-    int error = record_command_buffer(
-        app,
-        app->command_buffers[app->current_frame],
-        image_index
-    );
+    error = poll_uploads(app);
+    if (error != 0) {
+        return error;
+    }
+    bool acquire_uploads = app->uploads.acquiring.len > 0;
+    if (
+        acquire_uploads and
+        app->uploads.queued.len == 0 and
+        app->uploads.in_flight.len == 0
+    ) {
+        app->geometry_ready = true;
+    }
+
+    if (app->options.sync_mode == FRAME_SYNC_FENCES) {
+        vkResetFences(app->device, 1, &frame->in_flight_fence);
+    }
+
+    vkResetCommandBuffer(frame->command_buffer, 0);
+    error = record_command_buffer(app, frame, image_index);
     if (error != 0) {
         return error;
     }
 
-    VkSemaphore wait_semaphores[] = {
-        app->image_available_semaphores[app->current_frame]
+    uint64_t frame_value = app->frame_counter + 1;
+
+    VkSemaphoreSubmitInfo wait_semaphores[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = frame->image_available_semaphore,
+            .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = app->uploads.semaphore,
+            .value = app->uploads.acquire_value,
+            .stageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT |
+                VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+        },
     };
-    VkPipelineStageFlags wait_stages[] = {
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+    uint32_t wait_semaphore_count = countof(wait_semaphores);
+    if (!acquire_uploads) {
+        wait_semaphore_count -= 1;
+    }
+
+    // presentation only needs the color output, while the frame counter
+    // also guards the uniform buffer read by the vertex shader
+    VkSemaphoreSubmitInfo signal_semaphores[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = frame->render_finished_semaphore,
+            .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = app->frame_timeline,
+            .value = frame_value,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        },
     };
-    assert(countof(wait_semaphores) == countof(wait_stages));
+    uint32_t signal_semaphore_count = countof(signal_semaphores);
+    if (app->options.sync_mode != FRAME_SYNC_TIMELINE) {
+        signal_semaphore_count -= 1;
+    }
 
-    VkSemaphore signal_semaphores[] = {
-        app->render_finished_semaphores[app->current_frame]
+    VkCommandBufferSubmitInfo command_buffer_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = frame->command_buffer,
     };
 
-    VkSubmitInfo submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = countof(wait_semaphores),
-        .pWaitSemaphores = wait_semaphores,
-        .pWaitDstStageMask = wait_stages,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &app->command_buffers[app->current_frame],
-        .signalSemaphoreCount = countof(signal_semaphores),
-        .pSignalSemaphores = signal_semaphores,
+    VkSubmitInfo2 submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount = wait_semaphore_count,
+        .pWaitSemaphoreInfos = wait_semaphores,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &command_buffer_info,
+        .signalSemaphoreInfoCount = signal_semaphore_count,
+        .pSignalSemaphoreInfos = signal_semaphores,
     };
 
-    result = vkQueueSubmit(
+    result = vkQueueSubmit2(
         app->graphics_queue,
         1,
         &submit_info,
-        app->in_flight_fences[app->current_frame]
+        frame->in_flight_fence
     );
     if (result != VK_SUCCESS) {
         return APP_ERROR_DRAW_FRAME_SUBMIT;
     }
 
+    app->frame_counter = frame_value;
+    frame->frame_value = frame_value;
+
+    if (acquire_uploads) {
+        uploads_acquired(&app->uploads);
+    }
+
+    // submit whatever was queued since the last frame, at most once a frame
+    error = flush_uploads(app);
+    if (error != 0) {
+        return error;
+    }
+
     VkSwapchainKHR swapchain = app->swapchain;
 
+    uint64_t present_id = app->present_id + 1;
+    VkPresentIdKHR present_id_info = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+        .swapchainCount = 1,
+        .pPresentIds = &present_id,
+    };
+
     VkPresentInfoKHR present_info = {
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-        .waitSemaphoreCount = countof(signal_semaphores),
-        .pWaitSemaphores = signal_semaphores,
+        .pNext = app->present_wait_supported ? &present_id_info : NULL,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &frame->render_finished_semaphore,
         .swapchainCount = 1,
         .pSwapchains = &swapchain,
         .pImageIndices = &image_index,
         .pResults = NULL,
     };
 
-    app->current_frame = (app->current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+    app->current_frame = (app->current_frame + 1) % (uint32_t)app->frames.len;
 
     result = vkQueuePresentKHR(app->present_queue, &present_info);
+    if (result == VK_SUCCESS or result == VK_SUBOPTIMAL_KHR) {
+        app->present_id = present_id;
+        track_present(app, present_id);
+    }
     if (
         result == VK_ERROR_OUT_OF_DATE_KHR or
         result == VK_SUBOPTIMAL_KHR or
@@ -2487,146 +5887,501 @@ static int draw_frame(
     return 0;
 }
 
-void timestep_update(GameData *game_data) {
-    float fdt = (float)(TIMESTEP_NS) / (1000.0f * 1000.0f * 1000.0f);
+int64_t elapsed = 0;
+int64_t min_dt = 1000000000;
 
-    if (game_data->freeze) {
-        float acceleration = SQUARE_STOP_ACCELERATION *
-            (0.0f - game_data->rotation_velocity) / SQUARE_MAX_VELOCITY;
-        game_data->rotation_velocity += fdt * acceleration;
-    } else {
-        game_data->rotation_velocity += fdt * SQUARE_ACCELERATION * 
-            (float)game_data->direction;
+static int64_t cpu_time_ns(clockid_t clock) {
+    TimeSpec t;
+    if (clock_gettime(clock, &t) != 0) {
+        return 0;
+    }
+    return (int64_t)t.tv_sec * 1000L * 1000L * 1000L + (int64_t)t.tv_nsec;
+}
+
+static int frame_pacer_init(
+    FramePacer *pacer,
+    AppOptions *options,
+    bool present_timing
+) {
+    int refresh_rate = 60;
+    GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+    if (monitor != NULL) {
+        const GLFWvidmode *mode = glfwGetVideoMode(monitor);
+        if (mode != NULL and mode->refreshRate > 0) {
+            refresh_rate = mode->refreshRate;
+        }
     }
 
-    game_data->rotation_velocity = max(
-        min(
-            game_data->rotation_velocity,
-            SQUARE_MAX_VELOCITY
-        ),
-        -1.0f * SQUARE_MAX_VELOCITY
+    *pacer = (FramePacer){
+        .mode = options->pacing_mode,
+        .min_interval = 1000L * 1000L * 1000L / refresh_rate,
+        .margin = FRAME_PACER_MARGIN_NS,
+        .present_timing = present_timing,
+    };
+    if (pacer->mode == FRAME_PACING_FIXED_FPS) {
+        pacer->min_interval = 1000L * 1000L * 1000L /
+            (int64_t)options->fixed_fps;
+    }
+    pacer->frame_interval = pacer->min_interval;
+
+    if (timespec_now(&pacer->last_frame_end) != 0) {
+        return APP_ERROR_FRAME_PACER_CLOCK;
+    }
+    pacer->frame_start = pacer->last_frame_end;
+    pacer->report_start = pacer->last_frame_end;
+    pacer->report_cpu_start = cpu_time_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    return 0;
+}
+
+// Sleep until just before the predicted deadline of the next present so
+// that input is sampled and the frame is recorded as late as possible
+static int frame_pacer_wait(FramePacer *pacer) {
+    TimeSpec wake_time;
+    switch (pacer->mode) {
+        case FRAME_PACING_MIN_LATENCY:
+            // a measured present lands on the display refresh, which makes
+            // a much better base for the next deadline than our own timing
+            wake_time = pacer->last_frame_end;
+            if (pacer->has_last_present) {
+                wake_time = pacer->last_present;
+            }
+            timespec_add(
+                &wake_time,
+                pacer->frame_interval - pacer->work_estimate - pacer->margin
+            );
+            break;
+        case FRAME_PACING_FIXED_FPS:
+            wake_time = pacer->frame_start;
+            timespec_add(&wake_time, pacer->min_interval);
+            break;
+        case FRAME_PACING_MIN_POWER:
+        default:
+            // blocking in the fence wait and image acquire paces us to FIFO
+            wake_time = pacer->last_frame_end;
+            break;
+    }
+
+    TimeSpec now;
+    if (timespec_now(&now) != 0) {
+        return APP_ERROR_FRAME_PACER_CLOCK;
+    }
+
+    int64_t until_wake = timespec_diff(&wake_time, &now);
+    if (until_wake > 0) {
+        timespec_sleep_until(&wake_time);
+        now = wake_time;
+    } else if (
+        pacer->mode == FRAME_PACING_FIXED_FPS and
+        -until_wake < pacer->min_interval
+    ) {
+        // keep a steady cadence when only slightly late
+        now = wake_time;
+    }
+
+    pacer->frame_start = now;
+    pacer->frame_start_cpu = cpu_time_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    return 0;
+}
+
+static bool scene_is_static(VulkanApp *app) {
+    // keep drawing until uploaded geometry has made it into a frame
+    if (uploads_pending(&app->uploads)) {
+        return false;
+    }
+
+    Simulation *simulation = &app->simulation;
+    if (simulation_input_moving(simulation)) {
+        return false;
+    }
+
+    return game_snapshot_at_rest(
+        game_snapshot_buffer_read(&simulation->snapshots)
     );
+}
 
-    game_data->rotation_angle += game_data->rotation_velocity * fdt;
+// Forget the frame timing history after the loop was blocked for a while
+static int frame_pacer_reset(FramePacer *pacer) {
+    if (timespec_now(&pacer->last_frame_end) != 0) {
+        return APP_ERROR_FRAME_PACER_CLOCK;
+    }
+    pacer->frame_start = pacer->last_frame_end;
+    pacer->frame_interval = pacer->min_interval;
+    pacer->has_last_present = false;
 
-    if (game_data->rotation_angle >= 2.0f * AVEN_GLM_PI_F) {
-        game_data->rotation_angle -= 2.0f * AVEN_GLM_PI_F;
+    return 0;
+}
+
+static void frame_pacer_report(FramePacer *pacer, TimeSpec *now) {
+    int64_t report_elapsed = timespec_diff(now, &pacer->report_start);
+    if (report_elapsed < FRAME_PACER_REPORT_NS) {
+        return;
     }
-    if (game_data->rotation_angle < 0.0f) {
-        game_data->rotation_angle += 2.0f * AVEN_GLM_PI_F;
+
+    int64_t cpu_now = cpu_time_ns(CLOCK_PROCESS_CPUTIME_ID);
+    double seconds = (double)report_elapsed / 1e9;
+    printf(
+        "frame pacer (%s): %.1f fps, %.2f ms work, %.1f%% cpu",
+        FRAME_PACING_MODE_NAMES[pacer->mode],
+        (double)pacer->report_frames / seconds,
+        (double)pacer->report_work / (double)max(pacer->report_frames, 1U) /
+            1e6,
+        100.0 * (double)(cpu_now - pacer->report_cpu_start) /
+            (double)report_elapsed
+    );
+    if (pacer->report_presents > 0) {
+        printf(
+            ", %.2f ms frame to present%s",
+            (double)pacer->report_latency /
+                (double)pacer->report_presents / 1e6,
+            pacer->present_timing ? "" : " (estimated)"
+        );
     }
+    if (pacer->report_inputs > 0) {
+        printf(
+            ", %.2f ms input to present (max %.2f ms)",
+            (double)pacer->report_input_latency /
+                (double)pacer->report_inputs / 1e6,
+            (double)pacer->report_max_input_latency / 1e6
+        );
+    }
+    printf("\n");
+
+    pacer->report_start = *now;
+    pacer->report_cpu_start = cpu_now;
+    pacer->report_work = 0;
+    pacer->report_frames = 0;
+    pacer->report_latency = 0;
+    pacer->report_presents = 0;
+    pacer->report_input_latency = 0;
+    pacer->report_max_input_latency = 0;
+    pacer->report_inputs = 0;
 }
 
-int64_t elapsed = 0;
-int64_t min_dt = 1000000000;
+static int frame_pacer_end(FramePacer *pacer) {
+    TimeSpec now;
+    if (timespec_now(&now) != 0) {
+        return APP_ERROR_FRAME_PACER_CLOCK;
+    }
+
+    // the CPU time of this thread excludes time spent blocked on the GPU or
+    // the presentation engine, which is what the deadline has to cover
+    int64_t work = cpu_time_ns(CLOCK_THREAD_CPUTIME_ID) -
+        pacer->frame_start_cpu;
+    int64_t interval = timespec_diff(&now, &pacer->last_frame_end);
+    pacer->last_frame_end = now;
+
+    if (!pacer->present_timing) {
+        interval = min(
+            max(interval, pacer->min_interval),
+            4 * pacer->min_interval
+        );
+        pacer->frame_interval += (interval - pacer->frame_interval) / 8;
+    }
+    pacer->work_estimate += (work - pacer->work_estimate) / 8;
+
+    pacer->report_frames += 1;
+    pacer->report_work += work;
+
+    frame_pacer_report(pacer, &now);
+
+    return 0;
+}
 
 static int main_loop(
     VulkanApp *app,
     Arena *swapchain_arena,
     Arena temp_arena
 ) {
-    TimeSpec last_update;
-    int error;
+    int error = frame_pacer_init(
+        &app->pacer,
+        &app->options,
+        app->present_wait_supported
+    );
+    if (error != 0) {
+        return error;
+    }
+
+    error = simulation_start(&app->simulation);
+    if (error != 0) {
+        return error;
+    }
 
-    do {
-        error = clock_gettime(CLOCK_MONOTONIC, &last_update);
-    } while (error == EINTR);
+    error = record_threads_start(app);
     if (error != 0) {
-        return APP_ERROR_MAIN_LOOP_CLOCK;
+        simulation_stop(&app->simulation);
+        return error;
     }
 
-    int64_t remainder = 0;
+    app->redraw_requested = true;
+
     while (!glfwWindowShouldClose(app->window)) {
-        TimeSpec now;
-        do {
-            error = clock_gettime(CLOCK_MONOTONIC, &now);
-        } while (error == EINTR);
-        if (error != 0) {
-            return APP_ERROR_MAIN_LOOP_CLOCK;
+        arena_phase(&temp_arena, "frame");
+
+        // stop submitting frames while nothing on screen would change
+        if (
+            app->iconified or (
+                !app->redraw_requested and
+                app->presented_static_frame and
+                scene_is_static(app)
+            )
+        ) {
+            glfwWaitEvents();
+
+            error = frame_pacer_reset(&app->pacer);
+            if (error != 0) {
+                break;
+            }
+            continue;
+        }
+
+        if (app->present_wait_supported) {
+            error = collect_presents(
+                app,
+                app->options.pacing_mode == FRAME_PACING_MIN_LATENCY
+            );
+            if (error != 0) {
+                break;
+            }
         }
 
-        int64_t delta_time = timespec_diff(&now, &last_update) + remainder;
-        while (delta_time >= TIMESTEP_NS) {
-            delta_time -= TIMESTEP_NS;
-            timestep_update(&app->game_data);
+        error = frame_pacer_wait(&app->pacer);
+        if (error != 0) {
+            break;
         }
-        last_update = now;
-        remainder = delta_time;
 
         glfwPollEvents();
-        draw_frame(app, swapchain_arena, temp_arena);
+        if (app->input_pending) {
+            app->frame_input_time = app->input_time;
+            app->frame_has_input = true;
+            app->input_pending = false;
+        }
+
+        app->redraw_requested = false;
+        app->presented_static_frame = scene_is_static(app);
+        error = draw_frame(app, swapchain_arena, temp_arena);
+        if (error != 0) {
+            break;
+        }
+
+        error = frame_pacer_end(&app->pacer);
+        if (error != 0) {
+            break;
+        }
+
+        device_memory_report(app);
+    }
+
+    record_threads_stop(&app->record_threads);
+
+    int simulation_error = simulation_stop(&app->simulation);
+    if (error == 0) {
+        error = simulation_error;
     }
 
     vkDeviceWaitIdle(app->device);
 
-    return 0;
+    return error;
 }
 
 static void cleanup(VulkanApp *app) {
     cleanup_swapchain(app);
+    attachment_pool_cleanup(app);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-        vkDestroyBuffer(app->device, app->uniform_buffers[i], NULL);
-        vkFreeMemory(app->device, app->uniform_buffers_memory[i], NULL);
-    }
+    vkDestroyBuffer(app->device, app->uniform_ring.buffer, app->allocator);
+    device_memory_free(app, &app->uniform_ring.allocation);
 
-    vkDestroyDescriptorPool(app->device, app->descriptor_pool, NULL);
+    vkDestroyDescriptorPool(app->device, app->descriptor_pool, app->allocator);
 
-    vkDestroyDescriptorSetLayout(app->device, app->descriptor_set_layout, NULL);
+    vkDestroyDescriptorSetLayout(
+        app->device,
+        app->descriptor_set_layout,
+        app->allocator
+    );
 
-    vkDestroyBuffer(app->device, app->index_buffer, NULL);
-    vkFreeMemory(app->device, app->index_buffer_memory, NULL);
+    cleanup_upload_queue(app);
 
-    vkDestroyBuffer(app->device, app->vertex_buffer, NULL);
-    vkFreeMemory(app->device, app->vertex_buffer_memory, NULL);
+    vkDestroyBuffer(app->device, app->index_buffer, app->allocator);
+    device_memory_free(app, &app->index_buffer_allocation);
 
-    vkDestroyPipeline(app->device, app->graphics_pipeline, NULL);
-    vkDestroyPipelineLayout(app->device, app->pipeline_layout, NULL);
+    vkDestroyBuffer(app->device, app->vertex_buffer, app->allocator);
+    device_memory_free(app, &app->vertex_buffer_allocation);
+
+    vkDestroyPipeline(app->device, app->graphics_pipeline, app->allocator);
+    vkDestroyPipelineLayout(app->device, app->pipeline_layout, app->allocator);
+    vkDestroyPipelineCache(
+        app->device,
+        app->pipeline_cache.cache,
+        app->allocator
+    );
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    for (size_t i = 0; i < app->frames.len; ++i) {
+        FrameData *frame = &slice_get(app->frames, i);
         vkDestroySemaphore(
             app->device,
-            app->image_available_semaphores[i],
-            NULL
+            frame->image_available_semaphore,
+            app->allocator
         );
         vkDestroySemaphore(
             app->device,
-            app->render_finished_semaphores[i],
-            NULL
+            frame->render_finished_semaphore,
+            app->allocator
         );
-        vkDestroyFence(app->device, app->in_flight_fences[i], NULL);
+        vkDestroyFence(app->device, frame->in_flight_fence, app->allocator);
+
+        for (uint32_t j = 0; j < app->options.record_threads; ++j) {
+            vkDestroyCommandPool(
+                app->device,
+                frame->record_command_pools[j],
+                app->allocator
+            );
+        }
     }
 
-    vkDestroyCommandPool(app->device, app->command_pool, NULL);
+    vkDestroySemaphore(app->device, app->frame_timeline, app->allocator);
 
-    vkDestroyDevice(app->device, NULL);
+    vkDestroyCommandPool(app->device, app->command_pool, app->allocator);
 
-    vkDestroySurfaceKHR(app->instance, app->surface, NULL);
+    device_memory_cleanup(app);
+
+    vkDestroyDevice(app->device, app->allocator);
+
+    vkDestroySurfaceKHR(app->instance, app->surface, app->allocator);
 
 #ifdef ENABLE_VALIDATION_LAYERS
     vkDestroyDebugUtilsMessengerEXT(
         app->instance,
         app->debug_messenger,
-        NULL
+        app->allocator
     );
 #endif // ENABLE_VALIDATION_LAYERS
 
-    vkDestroyInstance(app->instance, NULL);
+    vkDestroyInstance(app->instance, app->allocator);
 
     glfwDestroyWindow(app->window);
     glfwTerminate();
 }
 
+static int allocate_frames(VulkanApp *app, Arena *perm_arena) {
+    uint32_t frame_count = app->options.frames_in_flight;
+    assert(frame_count >= 1 and frame_count <= MAX_FRAMES_IN_FLIGHT);
+
+    app->frames.ptr = arena_create_array(FrameData, perm_arena, frame_count);
+    if (app->frames.ptr == NULL) {
+        return APP_ERROR_ALLOCATE_FRAMES_ALLOC;
+    }
+    app->frames.len = frame_count;
+    memset(app->frames.ptr, 0, sizeof(*app->frames.ptr) * app->frames.len);
+
+    return 0;
+}
+
+// Lay the draws out on a square grid covering the viewport, a single draw
+// fills the whole viewport as before
+static int allocate_draws(VulkanApp *app, Arena *perm_arena) {
+    uint32_t draw_count = app->options.draw_count;
+    assert(draw_count >= 1 and draw_count <= MAX_DRAW_COUNT);
+
+    DrawStreams *draws = &app->draws;
+    draws->angle = arena_create_array(float, perm_arena, draw_count);
+    draws->scale = arena_create_array(float, perm_arena, draw_count);
+    draws->x = arena_create_array(float, perm_arena, draw_count);
+    draws->y = arena_create_array(float, perm_arena, draw_count);
+    if (
+        draws->angle == NULL or
+        draws->scale == NULL or
+        draws->x == NULL or
+        draws->y == NULL
+    ) {
+        return APP_ERROR_ALLOCATE_DRAWS_ALLOC;
+    }
+    draws->len = draw_count;
+
+    uint32_t side = 1;
+    while (side * side < draw_count) {
+        side += 1;
+    }
+
+    float cell = 2.0f / (float)side;
+    for (uint32_t i = 0; i < draw_count; ++i) {
+        uint32_t column = i % side;
+        uint32_t row = i / side;
+        draws->angle[i] = 0.0f;
+        draws->scale[i] = 1.0f / (float)side;
+        draws->x[i] = -1.0f + cell * ((float)column + 0.5f);
+        draws->y[i] = -1.0f + cell * ((float)row + 0.5f);
+    }
+
+    return 0;
+}
+
+static int allocate_memory_blocks(VulkanApp *app, Arena *perm_arena) {
+    app->device_memory.blocks = arena_create_array(
+        DeviceMemoryBlock,
+        perm_arena,
+        MAX_DEVICE_MEMORY_BLOCKS
+    );
+    if (app->device_memory.blocks == NULL) {
+        return APP_ERROR_ALLOCATE_MEMORY_BLOCKS_ALLOC;
+    }
+
+    return 0;
+}
+
 static int run(VulkanApp *app, Arena temp_arena) {
+    if (!scratch_init(SCRATCH_ARENA_SIZE)) {
+        return APP_ERROR_SCRATCH_INIT;
+    }
+
     Arena swapchain_arena = arena_init(
         arena_alloc(&temp_arena, SWAPCHAIN_ARENA_SIZE, 1),
         SWAPCHAIN_ARENA_SIZE
     );
     assert(swapchain_arena.base != NULL);
+    if (app->options.arena_stats) {
+        arena_stats_init(
+            &swapchain_arena,
+            &app->swapchain_arena_stats,
+            "startup"
+        );
+    }
 
     app->base_swapchain_arena = swapchain_arena;
 
-    int error = init_window(app);
+    app->uploads.arena = arena_init(
+        arena_alloc(&temp_arena, UPLOAD_ARENA_SIZE, 1),
+        UPLOAD_ARENA_SIZE
+    );
+    assert(app->uploads.arena.base != NULL);
+    app->uploads.pool = pool_init(BufferUpload);
+
+    int error = allocate_frames(app, &temp_arena);
+    if (error != 0) {
+        return error;
+    }
+
+    error = allocate_draws(app, &temp_arena);
+    if (error != 0) {
+        return error;
+    }
+
+    error = allocate_memory_blocks(app, &temp_arena);
+    if (error != 0) {
+        return error;
+    }
+
+    error = host_allocator_init(
+        &app->host_allocator,
+        &temp_arena,
+        app->options.host_memory_cap
+    );
+    if (error != 0) {
+        return error;
+    }
+    app->allocator = &app->host_allocator.callbacks;
+
+    error = init_window(app);
     if (error != 0) {
         return error;
     }
@@ -2641,28 +6396,141 @@ static int run(VulkanApp *app, Arena temp_arena) {
         return error;
     }
 
+    // a cache that can't be saved only costs the next start its warm up
+    int save_error = save_pipeline_cache(app, temp_arena);
+    if (save_error != 0) {
+        fprintf(
+            stderr,
+            "pipeline cache: failed to save %s (error %d)\n",
+            PIPELINE_CACHE_FILE,
+            save_error
+        );
+    }
+    pipeline_cache_report(app);
+
     cleanup(app);
 
+    host_allocator_report(&app->host_allocator);
+    host_allocator_cleanup(&app->host_allocator);
+    scratch_release();
+
     return 0;
 }
 
-int main(void) {
-    Arena arena = arena_init(
-        malloc(MASTER_ARENA_SIZE),
-        MASTER_ARENA_SIZE
+static void print_usage(const char *name) {
+    fprintf(
+        stderr,
+        "usage: %s [--pacing=min-latency|min-power] [--fps=N]"
+            " [--frames-in-flight=1..%d] [--sync=timeline|fences]"
+            " [--draws=N] [--record-threads=0..%d]"
+            " [--host-memory-cap=MiB] [--huge-pages] [--arena-stats]\n",
+        name,
+        MAX_FRAMES_IN_FLIGHT,
+        MAX_RECORD_THREADS
     );
+}
+
+static int parse_options(AppOptions *options, int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--pacing=min-latency") == 0) {
+            options->pacing_mode = FRAME_PACING_MIN_LATENCY;
+        } else if (strcmp(arg, "--pacing=min-power") == 0) {
+            options->pacing_mode = FRAME_PACING_MIN_POWER;
+        } else if (strcmp(arg, "--sync=timeline") == 0) {
+            options->sync_mode = FRAME_SYNC_TIMELINE;
+        } else if (strcmp(arg, "--sync=fences") == 0) {
+            options->sync_mode = FRAME_SYNC_FENCES;
+        } else if (strncmp(arg, "--fps=", 6) == 0) {
+            char *end;
+            unsigned long fps = strtoul(arg + 6, &end, 10);
+            if (*end != '\0' or fps == 0 or fps > 1000) {
+                return APP_ERROR_MAIN_ARGS;
+            }
+            options->pacing_mode = FRAME_PACING_FIXED_FPS;
+            options->fixed_fps = (uint32_t)fps;
+        } else if (strncmp(arg, "--frames-in-flight=", 19) == 0) {
+            char *end;
+            unsigned long frames = strtoul(arg + 19, &end, 10);
+            if (
+                *end != '\0' or
+                frames == 0 or
+                frames > MAX_FRAMES_IN_FLIGHT
+            ) {
+                return APP_ERROR_MAIN_ARGS;
+            }
+            options->frames_in_flight = (uint32_t)frames;
+        } else if (strncmp(arg, "--draws=", 8) == 0) {
+            char *end;
+            unsigned long draws = strtoul(arg + 8, &end, 10);
+            if (*end != '\0' or draws == 0 or draws > MAX_DRAW_COUNT) {
+                return APP_ERROR_MAIN_ARGS;
+            }
+            options->draw_count = (uint32_t)draws;
+        } else if (strncmp(arg, "--record-threads=", 17) == 0) {
+            char *end;
+            unsigned long threads = strtoul(arg + 17, &end, 10);
+            if (*end != '\0' or threads > MAX_RECORD_THREADS) {
+                return APP_ERROR_MAIN_ARGS;
+            }
+            options->record_threads = (uint32_t)threads;
+        } else if (strcmp(arg, "--huge-pages") == 0) {
+            options->huge_pages = true;
+        } else if (strcmp(arg, "--arena-stats") == 0) {
+            options->arena_stats = true;
+        } else if (strncmp(arg, "--host-memory-cap=", 18) == 0) {
+            char *end;
+            unsigned long cap = strtoul(arg + 18, &end, 10);
+            if (*end != '\0' or cap == 0 or cap > 1024 * 1024) {
+                return APP_ERROR_MAIN_ARGS;
+            }
+            options->host_memory_cap = (size_t)cap * 1024 * 1024;
+        } else {
+            return APP_ERROR_MAIN_ARGS;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    AppOptions options = {
+        .pacing_mode = FRAME_PACING_MIN_LATENCY,
+        .frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT,
+        .draw_count = 1,
+    };
+    int error = parse_options(&options, argc, argv);
+    if (error != 0) {
+        print_usage(argv[0]);
+        return error;
+    }
+
+    Arena arena = arena_reserve(MASTER_ARENA_SIZE, options.huge_pages);
     if (arena.base == NULL) {
-        return APP_ERROR_MAIN_MALLOC;
+        return APP_ERROR_MAIN_RESERVE;
+    }
+
+    // the reserved arena is kept as is for arena_release
+    ArenaStats arena_stats;
+    Arena stats_arena = arena;
+    if (options.arena_stats) {
+        arena_stats_init(&stats_arena, &arena_stats, "startup");
     }
 
     VulkanApp app = {
         .width = 480,
         .height = 480,
+        .options = options,
     };
 
-    int error = run(&app, arena);
+    error = run(&app, stats_arena);
+
+    if (options.arena_stats) {
+        arena_stats_report(&arena_stats, "master");
+        arena_stats_report(&app.swapchain_arena_stats, "swapchain");
+    }
 
-    free(arena.base);
+    arena_release(arena);
 
     return error;
 }